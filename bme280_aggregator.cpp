@@ -1,6 +1,6 @@
 /*!
  * Adapted from Adafruit_BME280.h + .cpp
- *  - Stipped out SPI support
+ *  - Moved bus access (I2C/SPI) into compile time bus policies, see bme280_bus.hpp
  *  - Removed Unified sensor integrations
  *  - Changed readout to use single batch readout
  *  - Add history storage of samples in gRTC
@@ -19,22 +19,25 @@
 
 #include "bme280_aggregator.hpp"
 #include "Arduino.h"
-#include <SPI.h>
-#include <Wire.h>
+#include <algorithm>
 #include <cstdint>
 
 #include "debug.hpp"
+#ifdef USE_SIM_SENSOR
+#include "bme280_sim.hpp"
+#endif
 
 /*!
  *   @brief  Initialise sensor with given parameters / settings
- *   @param addr the I2C address the device can be found on
- *   @param theWire the I2C object to use, defaults to &Wire
+ *   @param bus the bus policy instance (I2C address/TwoWire or CS pin/SPIClass)
+ *   @param sampling the oversampling/filter settings to use
  *   @returns true on success, false otherwise
  */
-auto BME280Aggregator::begin(uint8_t addr, TwoWire* theWire) -> bool {
+template <typename Bus>
+auto BME280Aggregator<Bus>::begin(const Bus& bus, const sampling_config& sampling) -> bool {
 	bool status = false;
-	m_i2caddr   = addr;
-	m_wire      = theWire;
+	m_bus       = bus;
+	m_sampling  = sampling;
 	status      = init();
 
 	if (!status) {
@@ -54,9 +57,9 @@ auto BME280Aggregator::begin(uint8_t addr, TwoWire* theWire) -> bool {
  *   @brief  Initialise sensor with given parameters / settings
  *   @returns true on success, false otherwise
  */
-auto BME280Aggregator::init() -> bool {
-	// I2C
-	m_wire->begin();
+template <typename Bus>
+auto BME280Aggregator<Bus>::init() -> bool {
+	m_bus.begin();
 
 	// check if sensor, i.e. the chip ID is correct
 	m_sensorId = read8(BME280_REGISTER_CHIPID);
@@ -72,20 +75,63 @@ auto BME280Aggregator::init() -> bool {
 	delay(10);
 
 	// if chip is still reading calibration, delay
+	uint32_t const start = millis();
 	while (isReadingCalibration()) {
+		if (millis() - start > BME280_NVM_TIMEOUT_MS) {
+			return false;
+		}
 		delay(10);
 	}
 
 	readCoefficients();   // read trimming parameters, see DS 4.2.2
 
 	// Change to lower sampling modes then default
-	setSampling(MODE_NORMAL, SAMPLING_X8, SAMPLING_X4, SAMPLING_X4, FILTER_OFF, STANDBY_MS_0_5);
+	setSampling(MODE_NORMAL,
+				static_cast<sensor_sampling>(m_sampling.osrs_t),
+				static_cast<sensor_sampling>(m_sampling.osrs_p),
+				static_cast<sensor_sampling>(m_sampling.osrs_h),
+				static_cast<sensor_filter>(m_sampling.filter),
+				STANDBY_MS_0_5);
 
-	delay(100);
+	// first conversions (enough for the IIR filter to have settled) have to be done before reading
+	delay(m_sampling.settleMs());
 
 	return true;
 }
 
+/*!
+ *   @brief  Maximum duration of one measurement with these settings (DS 9.1)
+ *   @returns conversion time in us
+ */
+template <typename Bus>
+auto BME280Aggregator<Bus>::sampling_config::conversionUs() const -> uint32_t {
+	static const uint8_t factors[] = {0, 1, 2, 4, 8};
+	auto const           factor    = [](uint8_t osrs) -> uint32_t { return osrs < sizeof(factors) ? factors[osrs] : 16; };
+
+	uint32_t us = 1250 + 2300 * factor(osrs_t);
+	if (osrs_p != SAMPLING_NONE) {
+		us += 2300 * factor(osrs_p) + 575;
+	}
+	if (osrs_h != SAMPLING_NONE) {
+		us += 2300 * factor(osrs_h) + 575;
+	}
+	return us;
+}
+
+/*!
+ *   @brief  Time init() waits after starting normal mode before the data registers are read
+ *
+ *   One measurement cycle with the filter off, otherwise as many cycles as the
+ *   filter coefficient, so a reading has seen that many samples since the reset.
+ *   @returns wait time in ms
+ */
+template <typename Bus>
+auto BME280Aggregator<Bus>::sampling_config::settleMs() const -> uint16_t {
+	uint32_t const cycles = filter == FILTER_OFF ? 1 : 1 << std::min<uint8_t>(filter, FILTER_X16);
+	// + t_standby of STANDBY_MS_0_5 per cycle
+	return (cycles * (conversionUs() + 500) + 999) / 1000;
+}
+
 /*!
  *   @brief  setup sensor with given parameters / settings
  *
@@ -98,12 +144,13 @@ auto BME280Aggregator::init() -> bool {
  *   @param filter the filter mode to use
  *   @param duration the standby duration to use
  */
-void BME280Aggregator::setSampling(sensor_mode      mode,
-								   sensor_sampling  tempSampling,
-								   sensor_sampling  pressSampling,
-								   sensor_sampling  humSampling,
-								   sensor_filter    filter,
-								   standby_duration duration) {
+template <typename Bus>
+void BME280Aggregator<Bus>::setSampling(sensor_mode      mode,
+										sensor_sampling  tempSampling,
+										sensor_sampling  pressSampling,
+										sensor_sampling  humSampling,
+										sensor_filter    filter,
+										standby_duration duration) {
 	m_measReg.mode   = mode;
 	m_measReg.osrs_t = tempSampling;
 	m_measReg.osrs_p = pressSampling;
@@ -125,82 +172,77 @@ void BME280Aggregator::setSampling(sensor_mode      mode,
 }
 
 /*!
- *   @brief  Writes an 8 bit value over I2C or SPI
+ *   @brief  Writes an 8 bit value over the bus
  *   @param reg the register address to write to
  *   @param value the value to write to the register
  */
-void BME280Aggregator::write8(byte reg, byte value) {
-	m_wire->beginTransmission(m_i2caddr);
-	m_wire->write(static_cast<uint8_t>(reg));
-	m_wire->write(static_cast<uint8_t>(value));
-	m_wire->endTransmission();
+template <typename Bus>
+void BME280Aggregator<Bus>::write8(byte reg, byte value) {
+	m_bus.write8(static_cast<uint8_t>(reg), static_cast<uint8_t>(value));
 }
 
 /*!
- *   @brief  Reads an 8 bit value over I2C or SPI
+ *   @brief  Reads an 8 bit value over the bus
  *   @param reg the register address to read from
  *   @returns the data byte read from the device
  */
-auto BME280Aggregator::read8(byte reg) -> uint8_t {
+template <typename Bus>
+auto BME280Aggregator<Bus>::read8(byte reg) -> uint8_t {
 	uint8_t value;
 
-	m_wire->beginTransmission(m_i2caddr);
-	m_wire->write(static_cast<uint8_t>(reg));
-	m_wire->endTransmission();
-	m_wire->requestFrom(m_i2caddr, static_cast<byte>(1));
-	value = m_wire->read();
+	m_bus.read(static_cast<uint8_t>(reg), &value, 1);
 	return value;
 }
 
 /*!
- *   @brief  Reads a 16 bit value over I2C or SPI
+ *   @brief  Reads a 16 bit value over the bus
  *   @param reg the register address to read from
  *   @returns the 16 bit data value read from the device
  */
-auto BME280Aggregator::read16(byte reg) -> uint16_t {
-	uint16_t value;
-
-	m_wire->beginTransmission(m_i2caddr);
-	m_wire->write(static_cast<uint8_t>(reg));
-	m_wire->endTransmission();
-	m_wire->requestFrom(m_i2caddr, static_cast<byte>(2));
-	value = (m_wire->read() << 8) | m_wire->read();
+template <typename Bus>
+auto BME280Aggregator<Bus>::read16(byte reg) -> uint16_t {
+	uint8_t buf[2];
 
-	return value;
+	m_bus.read(static_cast<uint8_t>(reg), buf, sizeof(buf));
+	return (buf[0] << 8) | buf[1];
 }
 
 /*!
- *   @brief  Reads a signed 16 bit little endian value over I2C or SPI
+ *   @brief  Reads a signed 16 bit little endian value over the bus
  *   @param reg the register address to read from
  *   @returns the 16 bit data value read from the device
  */
-auto BME280Aggregator::read16_LE(byte reg) -> uint16_t {
+template <typename Bus>
+auto BME280Aggregator<Bus>::read16_LE(byte reg) -> uint16_t {
 	uint16_t temp = read16(reg);
 	return (temp >> 8) | (temp << 8);
 }
 
 /*!
- *   @brief  Reads a signed 16 bit value over I2C or SPI
+ *   @brief  Reads a signed 16 bit value over the bus
  *   @param reg the register address to read from
  *   @returns the 16 bit data value read from the device
  */
-auto BME280Aggregator::readS16(byte reg) -> int16_t {
+template <typename Bus>
+auto BME280Aggregator<Bus>::readS16(byte reg) -> int16_t {
 	return static_cast<int16_t>(read16(reg));
 }
 
 /*!
- *   @brief  Reads a signed little endian 16 bit value over I2C or SPI
+ *   @brief  Reads a signed little endian 16 bit value over the bus
  *   @param reg the register address to read from
  *   @returns the 16 bit data value read from the device
  */
-auto BME280Aggregator::readS16_LE(byte reg) -> int16_t {
+template <typename Bus>
+auto BME280Aggregator<Bus>::readS16_LE(byte reg) -> int16_t {
 	return static_cast<int16_t>(read16_LE(reg));
 }
 
 /*!
  *   @brief  Reads the factory-set coefficients
  */
-void BME280Aggregator::readCoefficients() {
+template <typename Bus>
+void BME280Aggregator<Bus>::readCoefficients() {
 	m_bme280Calib.dig_T1 = read16_LE(BME280_REGISTER_DIG_T1);
 	m_bme280Calib.dig_T2 = readS16_LE(BME280_REGISTER_DIG_T2);
 	m_bme280Calib.dig_T3 = readS16_LE(BME280_REGISTER_DIG_T3);
@@ -248,13 +290,15 @@ void BME280Aggregator::readCoefficients() {
  *   @brief return true if chip is busy reading cal data
  *   @returns true if reading calibration, false otherwise
  */
-auto BME280Aggregator::isReadingCalibration() -> bool {
+template <typename Bus>
+auto BME280Aggregator<Bus>::isReadingCalibration() -> bool {
 	uint8_t const rStatus = read8(BME280_REGISTER_STATUS);
 
 	return (rStatus & (1 << 0)) != 0;
 }
 
-auto BME280Aggregator::adaptTemp(uint32_t raw_temp) -> int32_t {
+template <typename Bus>
+auto BME280Aggregator<Bus>::adaptTemp(uint32_t raw_temp) -> int32_t {
 	int32_t var1;
 	int32_t var2;
 
@@ -275,7 +319,8 @@ auto BME280Aggregator::adaptTemp(uint32_t raw_temp) -> int32_t {
 	return (m_tFine * 5 + 128);
 };
 
-auto BME280Aggregator::adaptPressure(uint32_t raw_press) -> int32_t {
+template <typename Bus>
+auto BME280Aggregator<Bus>::adaptPressure(uint32_t raw_press) -> int32_t {
 	int64_t var1;
 	int64_t var2;
 	int64_t p;
@@ -303,7 +348,8 @@ auto BME280Aggregator::adaptPressure(uint32_t raw_press) -> int32_t {
 	return ((p + var1 + var2) >> 8) + ((static_cast<int64_t>(m_bme280Calib.dig_P7)) << 4);
 };
 
-auto BME280Aggregator::adaptHumidity(uint32_t raw_humidity) -> int32_t {
+template <typename Bus>
+auto BME280Aggregator<Bus>::adaptHumidity(uint32_t raw_humidity) -> int32_t {
 	int32_t v_x1_u32r;
 
 	if (raw_humidity == 0x8000) {   // value in case humidity measurement was disabled
@@ -331,7 +377,8 @@ auto BME280Aggregator::adaptHumidity(uint32_t raw_humidity) -> int32_t {
 	return (v_x1_u32r >> 12);
 };
 
-auto BME280Aggregator::readAllSensors() -> sensor_data {
+template <typename Bus>
+auto BME280Aggregator<Bus>::readAllSensors() -> sensor_data {
 	// Datasheet MemoryMap has these in ascending order
 	using sensor_regs = struct {
 		uint8_t press_msb;
@@ -359,16 +406,7 @@ auto BME280Aggregator::readAllSensors() -> sensor_data {
 
 	sensor_regs raw_regs;
 
-	m_wire->beginTransmission(m_i2caddr);
-	m_wire->write(static_cast<uint8_t>(BME280_REGISTER_PRESSUREDATA));
-	m_wire->endTransmission();
-	m_wire->requestFrom(m_i2caddr, static_cast<byte>(sizeof(raw_regs)));
-
-	auto* raw_ptr = reinterpret_cast<uint8_t*>(&raw_regs);
-	for (uint8_t i = 0; i < sizeof(raw_regs); i++) {
-		*raw_ptr = m_wire->read();
-		raw_ptr++;
-	}
+	m_bus.read(BME280_REGISTER_PRESSUREDATA, reinterpret_cast<uint8_t*>(&raw_regs), sizeof(raw_regs));
 
 	return {
 		.temperature = adaptTemp(raw_regs.getTemp()),
@@ -377,10 +415,43 @@ auto BME280Aggregator::readAllSensors() -> sensor_data {
 	};
 }
 
+/*!
+ *   @brief  Runs a single measurement in forced mode and times it by polling the status register
+ *
+ *   Leaves the sensor in sleep mode, the next init() restarts normal mode.
+ *   @returns measured conversion time in us, 0 if the sensor didn't finish in time
+ */
+template <typename Bus>
+auto BME280Aggregator<Bus>::timeForcedConversion() -> uint32_t {
+	m_measReg.mode = MODE_FORCED;
+	write8(BME280_REGISTER_CONTROL, MODE_SLEEP);
+	write8(BME280_REGISTER_CONTROL, m_measReg.get());
+	uint32_t const start = micros();
+
+	// the sensor returns to sleep mode by itself once done
+	m_measReg.mode = MODE_SLEEP;
+
+	// measuring bit, DS 5.4.4
+	while ((read8(BME280_REGISTER_STATUS) & (1 << 3)) != 0) {
+		if (micros() - start > 2 * m_sampling.conversionUs()) {
+			return 0;
+		}
+	}
+	return micros() - start;
+}
+
 /*!
  *   Returns Sensor ID found by init() for diagnostics
  *   @returns Sensor ID 0x60 for BME280, 0x56, 0x57, 0x58 BMP280
  */
-auto BME280Aggregator::sensorID() -> uint32_t {
+template <typename Bus>
+auto BME280Aggregator<Bus>::sensorID() -> uint32_t {
 	return m_sensorId;
 }
+
+// Only these bus policies are used, keep the definitions in this translation unit
+template class BME280Aggregator<BME280I2CBus>;
+template class BME280Aggregator<BME280SPIBus>;
+#ifdef USE_SIM_SENSOR
+template class BME280Aggregator<BME280I2CBusT<BME280Sim>>;
+#endif
\ No newline at end of file
@@ -2,8 +2,7 @@
 
 #include "Arduino.h"
 
-#include <SPI.h>
-#include <Wire.h>
+#include "bme280_bus.hpp"
 
 /*
 	Adapted from Adafruit_BME280.h + .cpp
@@ -20,44 +19,48 @@
 	Humidity: 0-100% => 0-128 => 7 bit
  */
 
+// value / 10^decimals (decimals <= 4), sign printed separately as -0.5 has no integer part to carry it
+inline auto printFixed(char *buf, size_t len, int32_t value, uint8_t decimals) -> int {
+	static const uint32_t scales[] = {1, 10, 100, 1000, 10000};
+	uint32_t const        magnitude = value < 0 ? 0u - static_cast<uint32_t>(value) : static_cast<uint32_t>(value);
+	uint32_t const        scale     = scales[decimals];
+	return snprintf(buf, len, "%s%u.%0*u", value < 0 ? "-" : "", magnitude / scale, decimals, magnitude % scale);
+}
+
 using sensor_data = struct sensor_data_s {
 	int32_t temperature;   // : 20;
 	int32_t pressure;      // : 20;
 	int32_t humidity;      // : 16;
 
-	auto getTemp() -> int32_t {
+	auto getTemp() const -> int32_t {
 		// Returns temperature in .001 DegC steps
 		return (temperature * 10) >> 8;
 	};
-	auto getPress() -> int32_t {
+	auto getPress() const -> int32_t {
 		// FIXME: Might need widening here
 		return (pressure * 25) >> 6;
 	};
-	auto getHum() -> int32_t {
+	auto getHum() const -> int32_t {
 		// Returns humidity from 0 to 10000 (where 10k is 100%)
 		return (humidity * 100) >> 10;
 	};
 
-	auto toString() -> String {
+	// Influx line protocol fields, returns the snprintf result
+	auto printTo(char *buf, size_t len) const -> int {
+		char temp[16], press[16], hum[16];
+		printFixed(temp, sizeof(temp), getTemp(), 3);
+		printFixed(press, sizeof(press), getPress(), 2);
+		printFixed(hum, sizeof(hum), getHum(), 4);
+		return snprintf(buf, len, "temperature=%s,pressure=%s,humidity=%s", temp, press, hum);
+	}
+
+	auto toString() const -> String {
 		char full_str[128];
-		snprintf(full_str,
-				 sizeof(full_str),
-				 "temperature=%d.%03d,pressure=%d.%02d,humidity=%d.%04d",
-				 getTemp() / 1000,
-				 getTemp() % 1000 + (1000 * (getTemp() < 0)),   // Correct for negative % returning remainder (=> negative for x < 0)
-				 getPress() / 100,
-				 getPress() % 100,
-				 getHum() / 10000,
-				 getHum() % 10000);
+		printTo(full_str, sizeof(full_str));
 		return String(full_str);
 	}
 };
 
-/*!
- *  @brief  default I2C address
- */
-#define BME280_ADDRESS (0x76)   // Primary I2C Address
-
 /*!
  *  @brief Register addresses
  */
@@ -130,8 +133,11 @@ typedef struct {
 /**************************************************************************/
 /*!
 	@brief  Class that stores state and functions for interacting with BME280 IC
+
+	Bus is one of the policies from bme280_bus.hpp (BME280I2CBus, BME280SPIBus).
 */
 /**************************************************************************/
+template <typename Bus>
 class BME280Aggregator {
 public:
 	/**************************************************************************/
@@ -178,7 +184,22 @@ public:
 		STANDBY_MS_1000 = 0b101
 	};
 
-	auto begin(uint8_t addr = BME280_ADDRESS, TwoWire *theWire = &Wire) -> bool;
+	/**************************************************************************/
+	/*!
+		@brief  oversampling/filter settings applied by init(), raw register codes
+	*/
+	/**************************************************************************/
+	struct sampling_config {
+		uint8_t osrs_t;   ///< temperature oversampling, see sensor_sampling
+		uint8_t osrs_p;   ///< pressure oversampling, see sensor_sampling
+		uint8_t osrs_h;   ///< humidity oversampling, see sensor_sampling
+		uint8_t filter;   ///< IIR filter, see sensor_filter
+
+		auto conversionUs() const -> uint32_t;
+		auto settleMs() const -> uint16_t;
+	};
+
+	auto begin(const Bus &bus = Bus(), const sampling_config &sampling = {SAMPLING_X8, SAMPLING_X4, SAMPLING_X4, FILTER_OFF}) -> bool;
 	auto init() -> bool;
 
 	void setSampling(sensor_mode      mode          = MODE_NORMAL,
@@ -189,12 +210,12 @@ public:
 					 standby_duration duration      = STANDBY_MS_0_5);
 
 	auto readAllSensors() -> sensor_data;
+	auto timeForcedConversion() -> uint32_t;
 
 	auto sensorID() -> uint32_t;
 
 protected:
-	TwoWire * m_wire;   //!< pointer to a TwoWire object
-	SPIClass *m_spi;    //!< pointer to SPI object
+	Bus m_bus;   //!< bus policy instance (I2C or SPI)
 
 	void readCoefficients();
 	auto isReadingCalibration() -> bool;
@@ -210,13 +231,13 @@ protected:
 	auto read16_LE(byte reg) -> uint16_t;   // little endian
 	auto readS16_LE(byte reg) -> int16_t;   // little endian
 
-	uint8_t m_i2caddr;    //!< I2C addr for the TwoWire interface
 	int32_t m_sensorId;   //!< ID of the BME Sensor
 	int32_t m_tFine;      //!< temperature with high resolution, stored as an attribute
 						  //!< as this is used for temperature compensation reading
 						  //!< humidity and pressure
 
 	bme280_calib_data m_bme280Calib;   //!< here calibration data is stored
+	sampling_config   m_sampling;      //!< settings applied by init()
 
 	/**************************************************************************/
 	/*!
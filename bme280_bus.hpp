@@ -0,0 +1,130 @@
+#pragma once
+
+#include "Arduino.h"
+
+#include <SPI.h>
+#include <Wire.h>
+
+/*
+	Bus policies for BME280Aggregator.
+
+	The aggregator is templated on one of these, so the register accessors collapse into direct
+	TwoWire/SPIClass calls at compile time. A policy has to provide:
+	 - begin():                       bring up the bus
+	 - write8(reg, value):            single register write
+	 - read(reg, buf, len):           burst read of len bytes starting at reg (auto increment)
+
+	Nominal wire time per transaction (8 byte readAllSensors burst / 1 byte register read),
+	excluding ESP side call overhead:
+	 - I2C @ 100 kHz: ~1.1 ms / ~0.4 ms (addr+reg write, repeated start, addr + n data bytes, 9 bit per byte)
+	 - I2C @ 400 kHz: ~0.28 ms / ~0.1 ms
+	 - SPI @ 10 MHz:  ~8 us / ~2 us (1 address byte + n data bytes, 8 bit per byte, plus CS toggling)
+	Note that the ESP8266 Wire implementation is bit-banged, so the effective I2C clock tends to stay
+	below the requested one.
+ */
+
+/*!
+ *  @brief  default I2C address
+ */
+#define BME280_ADDRESS (0x76)   // Primary I2C Address
+
+#define BME280_I2C_CLOCK 400000
+#define BME280_SPI_CLOCK 10000000
+// Give up on a sensor that still copies its NVM after this long, DS 1.1 specifies 2 ms startup time
+#define BME280_NVM_TIMEOUT_MS 50
+
+// Default bus instance for the I2C policy, only TwoWire has a global one
+template <typename WireT>
+inline auto bme280DefaultWire() -> WireT * {
+	return nullptr;
+}
+template <>
+inline auto bme280DefaultWire<TwoWire>() -> TwoWire * {
+	return &Wire;
+}
+
+// WireT is anything TwoWire compatible, e.g. BME280Sim (bme280_sim.hpp)
+template <typename WireT = TwoWire>
+class BME280I2CBusT {
+public:
+	// Non-explicit on purpose: allows bme.begin(0x76)
+	BME280I2CBusT(uint8_t addr = BME280_ADDRESS, WireT *theWire = bme280DefaultWire<WireT>(), uint32_t clock = BME280_I2C_CLOCK)
+		: m_wire(theWire), m_addr(addr), m_clock(clock) {
+	}
+
+	inline void begin() {
+		m_wire->begin();
+		m_wire->setClock(m_clock);
+	}
+
+	inline void write8(uint8_t reg, uint8_t value) {
+		m_wire->beginTransmission(m_addr);
+		m_wire->write(reg);
+		m_wire->write(value);
+		m_wire->endTransmission();
+	}
+
+	inline void read(uint8_t reg, uint8_t *buf, uint8_t len) {
+		m_wire->beginTransmission(m_addr);
+		m_wire->write(reg);
+		m_wire->endTransmission();
+		m_wire->requestFrom(m_addr, len);
+		for (uint8_t i = 0; i < len; i++) {
+			buf[i] = m_wire->read();
+		}
+	}
+
+private:
+	WireT *  m_wire;    //!< pointer to a TwoWire object
+	uint8_t  m_addr;    //!< I2C addr for the TwoWire interface
+	uint32_t m_clock;   //!< I2C clock in Hz
+};
+
+using BME280I2CBus = BME280I2CBusT<>;
+
+class BME280SPIBus {
+public:
+	// Non-explicit on purpose: allows bme.begin(BME280_CS_PIN)
+	BME280SPIBus(uint8_t csPin = SS, SPIClass *theSPI = &SPI, uint32_t clock = BME280_SPI_CLOCK)
+		: m_spi(theSPI), m_settings(clock, MSBFIRST, SPI_MODE0), m_cs(csPin) {
+	}
+
+	inline void begin() {
+		digitalWrite(m_cs, HIGH);
+		pinMode(m_cs, OUTPUT);
+		m_spi->begin();
+	}
+
+	inline void write8(uint8_t reg, uint8_t value) {
+		select();
+		// MSB cleared => write
+		m_spi->transfer(reg & ~0x80);
+		m_spi->transfer(value);
+		deselect();
+	}
+
+	inline void read(uint8_t reg, uint8_t *buf, uint8_t len) {
+		select();
+		// MSB set => read, address auto increments for as long as CS is held
+		m_spi->transfer(reg | 0x80);
+		for (uint8_t i = 0; i < len; i++) {
+			buf[i] = m_spi->transfer(0);
+		}
+		deselect();
+	}
+
+private:
+	inline void select() {
+		m_spi->beginTransaction(m_settings);
+		digitalWrite(m_cs, LOW);
+	}
+
+	inline void deselect() {
+		digitalWrite(m_cs, HIGH);
+		m_spi->endTransaction();
+	}
+
+	SPIClass *  m_spi;        //!< pointer to SPI object
+	SPISettings m_settings;   //!< clock/mode used for each transaction
+	uint8_t     m_cs;         //!< chip select pin
+};
@@ -0,0 +1,374 @@
+#include "bme280_sim.hpp"
+
+#include "config.hpp"
+
+#ifdef USE_SIM_SENSOR
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+/*
+	Calibration dump used by default: T/P coefficients are the worked example from the BMP280 datasheet (DS 8.1),
+	H coefficients taken from a BME280 on one of our nodes.
+ */
+const bme280_sim_dump kBME280SimDefaultDump = {
+	{0x70, 0x6B, 0x43, 0x67, 0x18, 0xFC, 0x7D, 0x8E, 0x43, 0xD6, 0xD0, 0x0B, 0x27,
+	 0x0B, 0x8C, 0x00, 0xF9, 0xFF, 0x8C, 0x3C, 0xF8, 0xC6, 0x70, 0x17, 0x00, 0x4B},
+	{0x6A, 0x01, 0x00, 0x13, 0x29, 0x03, 0x1E},
+};
+
+namespace {
+// Datasheet example readings (DS 8.1) => 25.08 DegC, 1006.5 hPa
+const uint32_t kDefaultAdcT = 519888;
+const uint32_t kDefaultAdcP = 415148;
+const uint16_t kDefaultAdcH = 0x6E5A;
+
+// Data registers 0xF7..0xFE after reset and for skipped channels (DS 5.4.7 - 5.4.9)
+const uint8_t kResetData[] = {0x80, 0x00, 0x00, 0x80, 0x00, 0x00, 0x80, 0x00};
+
+enum { CH_P, CH_T, CH_H, CHANNELS };
+
+// Multiplier for the osrs_x register fields
+auto oversampling(uint8_t osrs) -> uint32_t {
+	static const uint8_t factors[] = {0, 1, 2, 4, 8};
+	return osrs < sizeof(factors) ? factors[osrs] : 16;
+}
+
+// Wrap safe "a is later than b"
+auto after(uint32_t a, uint32_t b) -> bool {
+	return static_cast<int32_t>(a - b) > 0;
+}
+}   // namespace
+
+BME280Sim::BME280Sim(uint8_t addr, const bme280_sim_dump &dump)
+	: m_addr(addr),
+	  m_pointer(0),
+	  m_txActive(false),
+	  m_txForUs(false),
+	  m_txHavePointer(false),
+	  m_txBytes(0),
+	  m_rxLeft(0),
+	  m_rxNack(false),
+	  m_clock(100000),
+	  m_simTimeUs(0),
+	  m_timeSource(nullptr),
+	  m_busyUntil(0),
+	  m_measuringUntil(0),
+	  m_forcedPending(false),
+	  m_cycleStart(0),
+	  m_conversions(0),
+	  m_rng(1),
+	  m_filterStarted(false),
+	  m_nackCount(0),
+	  m_stuckBusy(false) {
+	memset(m_regs, 0, sizeof(m_regs));
+	memset(m_noise, 0, sizeof(m_noise));
+	m_regs[0xD0] = 0x60;
+	loadDump(dump);
+	setRawSample(kDefaultAdcT, kDefaultAdcP, kDefaultAdcH);
+	softReset();
+	resetStats();
+}
+
+void BME280Sim::begin() {
+}
+
+void BME280Sim::setClock(uint32_t frequency) {
+	m_clock = frequency;
+}
+
+void BME280Sim::beginTransmission(uint8_t addr) {
+	m_txActive      = true;
+	m_txForUs       = addr == m_addr && !nackPending();
+	m_txHavePointer = false;
+	m_txBytes       = 0;
+}
+
+auto BME280Sim::write(uint8_t data) -> size_t {
+	if (!m_txActive) {
+		return 0;
+	}
+	m_txBytes++;
+	if (!m_txForUs) {
+		return 1;
+	}
+	// Writes are sent as (register, value) pairs, the register address does not auto increment (DS 6.2.1)
+	if (!m_txHavePointer) {
+		m_pointer       = data;
+		m_txHavePointer = true;
+	} else {
+		writeRegister(m_pointer, data);
+		m_txHavePointer = false;
+	}
+	return 1;
+}
+
+auto BME280Sim::endTransmission(bool /*sendStop*/) -> uint8_t {
+	if (!m_txActive) {
+		return 4;
+	}
+	m_txActive = false;
+	if (!m_txForUs) {
+		// Address not acknowledged, nothing after the address byte goes on the wire
+		account(0);
+		m_stats.nacks++;
+		return 2;
+	}
+	account(m_txBytes);
+	m_stats.bytesWritten += m_txBytes;
+	return 0;
+}
+
+auto BME280Sim::requestFrom(uint8_t addr, uint8_t len) -> uint8_t {
+	m_rxNack = addr != m_addr || nackPending();
+	if (m_rxNack) {
+		account(0);
+		m_stats.nacks++;
+		m_rxLeft = 0;
+		return 0;
+	}
+	account(len);
+	m_stats.bytesRead += len;
+	// Data registers are shadowed for the duration of the burst
+	update();
+	m_rxLeft = len;
+	return len;
+}
+
+auto BME280Sim::available() -> int {
+	return m_rxLeft;
+}
+
+auto BME280Sim::read() -> int {
+	if (m_rxLeft == 0) {
+		return -1;
+	}
+	m_rxLeft--;
+	// Reads auto increment the register address (DS 6.2.2)
+	return readRegister(m_pointer++);
+}
+
+void BME280Sim::loadDump(const bme280_sim_dump &dump) {
+	memcpy(&m_regs[0x88], dump.cal1, sizeof(dump.cal1));
+	memcpy(&m_regs[0xE1], dump.cal2, sizeof(dump.cal2));
+}
+
+void BME280Sim::setRawSample(uint32_t adcT, uint32_t adcP, uint16_t adcH) {
+	m_adc[CH_P] = adcP;
+	m_adc[CH_T] = adcT;
+	m_adc[CH_H] = adcH;
+}
+
+void BME280Sim::setNoise(float sigmaT, float sigmaP, float sigmaH, uint32_t seed) {
+	m_noise[CH_P] = sigmaP;
+	m_noise[CH_T] = sigmaT;
+	m_noise[CH_H] = sigmaH;
+	m_rng         = seed != 0 ? seed : 1;
+}
+
+void BME280Sim::setTimeSource(uint32_t (*nowUs)()) {
+	m_timeSource = nowUs;
+}
+
+void BME280Sim::advance(uint32_t us) {
+	m_simTimeUs += us;
+}
+
+void BME280Sim::nackNext(uint32_t count) {
+	m_nackCount = count;
+}
+
+void BME280Sim::setStuckBusy(bool stuck) {
+	m_stuckBusy = stuck;
+}
+
+auto BME280Sim::stats() const -> const stats_s & {
+	return m_stats;
+}
+
+void BME280Sim::resetStats() {
+	memset(&m_stats, 0, sizeof(m_stats));
+}
+
+auto BME280Sim::reg(uint8_t addr) const -> uint8_t {
+	return m_regs[addr];
+}
+
+auto BME280Sim::now() -> uint32_t {
+	return m_timeSource != nullptr ? m_timeSource() : m_simTimeUs;
+}
+
+void BME280Sim::account(uint32_t dataBytes) {
+	// start + address byte + data bytes (each 8 bit + ack) + stop
+	uint32_t const bits = 1 + 9 * (dataBytes + 1) + 1;
+	uint32_t const us   = (bits * 1000000UL + m_clock - 1) / m_clock;
+	m_stats.transactions++;
+	m_stats.busTimeUs += us;
+	m_simTimeUs += us;
+}
+
+auto BME280Sim::nackPending() -> bool {
+	if (m_nackCount == 0) {
+		return false;
+	}
+	m_nackCount--;
+	return true;
+}
+
+auto BME280Sim::readRegister(uint8_t addr) -> uint8_t {
+	if (addr == 0xF3) {
+		if (m_stuckBusy) {
+			return 0x09;
+		}
+		update();
+		uint32_t const t      = now();
+		uint8_t        status = 0;
+		if (m_forcedPending && after(m_measuringUntil, t)) {
+			status |= 0x08;
+		}
+		if ((m_regs[0xF4] & 0x03) == 0x03 && (t - m_cycleStart) % (conversionUs() + standbyUs()) < conversionUs()) {
+			status |= 0x08;
+		}
+		if (after(m_busyUntil, t)) {
+			status |= 0x01;
+		}
+		return status;
+	}
+	return m_regs[addr];
+}
+
+void BME280Sim::writeRegister(uint8_t addr, uint8_t value) {
+	switch (addr) {
+		case 0xE0:
+			if (value == 0xB6) {
+				softReset();
+			}
+			break;
+		case 0xF2:
+			m_regs[addr] = value & 0x07;
+			break;
+		case 0xF4: {
+			// Conversions completed with the old settings
+			update();
+			bool const wasNormal = (m_regs[addr] & 0x03) == 0x03;
+			m_regs[addr]         = value;
+			// Forced mode (01 or 10): single conversion, then back to sleep
+			if ((value & 0x03) == 0x01 || (value & 0x03) == 0x02) {
+				m_forcedPending  = true;
+				m_measuringUntil = now() + conversionUs();
+				m_regs[addr] &= ~0x03;
+			} else if ((value & 0x03) == 0x03 && !wasNormal) {
+				m_cycleStart  = now();
+				m_conversions = 0;
+			}
+			break;
+		}
+		case 0xF5:
+			update();
+			if (((m_regs[addr] ^ value) & 0x1C) != 0) {
+				m_filterStarted = false;
+			}
+			m_regs[addr] = value & 0xFD;
+			break;
+		default:
+			// Everything else is read only
+			break;
+	}
+}
+
+void BME280Sim::softReset() {
+	m_regs[0xF2]     = 0;
+	m_regs[0xF4]     = 0;
+	m_regs[0xF5]     = 0;
+	m_forcedPending  = false;
+	m_filterStarted  = false;
+	m_measuringUntil = now();
+	m_busyUntil      = now() + BME280_SIM_STARTUP_US;
+	memcpy(&m_regs[0xF7], kResetData, sizeof(kResetData));
+}
+
+// Latches the conversions that completed by now
+void BME280Sim::update() {
+	uint32_t const t = now();
+	if (m_forcedPending && !after(m_measuringUntil, t)) {
+		m_forcedPending = false;
+		convert();
+	}
+	if ((m_regs[0xF4] & 0x03) != 0x03) {
+		return;
+	}
+	uint32_t const conversion = conversionUs();
+	uint32_t const elapsed    = t - m_cycleStart;
+	uint32_t const done       = elapsed < conversion ? 0 : 1 + (elapsed - conversion) / (conversion + standbyUs());
+	// Only the most recent conversions can still make a difference
+	if (done - m_conversions > 64) {
+		m_conversions = done - 64;
+	}
+	for (; m_conversions < done; m_conversions++) {
+		convert();
+	}
+}
+
+void BME280Sim::convert() {
+	uint8_t const osrs[CHANNELS] = {static_cast<uint8_t>((m_regs[0xF4] >> 2) & 0x07),
+									static_cast<uint8_t>(m_regs[0xF4] >> 5),
+									static_cast<uint8_t>(m_regs[0xF2] & 0x07)};
+	// filter code 0 => off, else coefficient 2, 4, 8, 16 (DS 5.4.6)
+	uint8_t const  filter      = (m_regs[0xF5] >> 2) & 0x07;
+	int32_t const  coefficient = filter == 0 ? 1 : 1 << std::min<uint8_t>(filter, 4);
+	uint8_t* const data        = &m_regs[0xF7];
+	for (uint8_t ch = 0; ch < CHANNELS; ch++) {
+		if (osrs[ch] == 0) {
+			// Skipped channels read as their reset value
+			memcpy(data + 3 * ch, kResetData + 3 * ch, ch == CH_H ? 2 : 3);
+			continue;
+		}
+		int32_t value = m_adc[ch];
+		if (m_noise[ch] > 0) {
+			value += lround(gaussian() * m_noise[ch] / sqrtf(oversampling(osrs[ch])));
+		}
+		if (ch != CH_H && coefficient > 1) {
+			m_filtered[ch] = m_filterStarted ? (m_filtered[ch] * (coefficient - 1) + value) / coefficient : value;
+			value          = m_filtered[ch];
+		}
+		if (ch == CH_H) {
+			value   = std::min<int32_t>(std::max<int32_t>(value, 0), 0xFFFF);
+			data[6] = value >> 8;
+			data[7] = value & 0xFF;
+		} else {
+			// 20 bit values, msb[19:12] lsb[11:4] xlsb[3:0] in bits 7..4
+			value            = std::min<int32_t>(std::max<int32_t>(value, 0), 0xFFFFF);
+			data[3 * ch]     = (value >> 12) & 0xFF;
+			data[3 * ch + 1] = (value >> 4) & 0xFF;
+			data[3 * ch + 2] = (value << 4) & 0xF0;
+		}
+	}
+	m_filterStarted = true;
+}
+
+auto BME280Sim::conversionUs() const -> uint32_t {
+	// Typical measurement time, DS 9.1
+	uint32_t const t = oversampling(m_regs[0xF4] >> 5);
+	uint32_t const p = oversampling((m_regs[0xF4] >> 2) & 0x07);
+	uint32_t const h = oversampling(m_regs[0xF2] & 0x07);
+	return 1000 + 2000 * t + (p != 0 ? 2000 * p + 500 : 0) + (h != 0 ? 2000 * h + 500 : 0);
+}
+
+auto BME280Sim::standbyUs() const -> uint32_t {
+	// t_sb, config register bits 7..5 (DS 5.4.6)
+	static const uint32_t standby[] = {500, 62500, 125000, 250000, 500000, 1000000, 10000, 20000};
+	return standby[m_regs[0xF5] >> 5];
+}
+
+// Box-Muller on a xorshift32 stream, only has to be repeatable
+auto BME280Sim::gaussian() -> float {
+	float u[2];
+	for (auto& x : u) {
+		m_rng ^= m_rng << 13;
+		m_rng ^= m_rng >> 17;
+		m_rng ^= m_rng << 5;
+		x = (m_rng + 1.0f) / 4294967297.0f;
+	}
+	return sqrtf(-2.0f * logf(u[0])) * cosf(6.2831853f * u[1]);
+}
+#endif
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+	Register level BME280 model behind a TwoWire compatible interface.
+
+	Plugs into BME280I2CBusT<BME280Sim>, so BME280Aggregator::init/readCoefficients/isReadingCalibration/readAllSensors
+	run unmodified against it. Only depends on the standard library so it can be built on the host as well as in the
+	firmware (USE_SIM_SENSOR in config.hpp).
+
+	Modelled:
+	 - chip id, calibration blocks (0x88..0xA1, 0xE1..0xE7) loaded from a calibration dump
+	 - ctrl_hum/ctrl_meas/config registers, soft reset (0xE0 <- 0xB6) clearing them
+	 - forced mode: one conversion (DS 9.1, typical duration), then back to sleep
+	 - normal mode: conversions back to back, t_standby (config register) apart, starting when normal mode is entered
+	 - status register: im_update for BME280_SIM_STARTUP_US after reset, measuring while a conversion runs
+	 - data registers 0xF7..0xFE: reset values (0x80000 / 0x8000) until the first conversion, then the configured raw
+	   sample, latched when a conversion completes. A burst read sees the state at its start (shadowing, DS 4).
+	   Skipped channels (osrs 0) read as their reset values.
+	 - measurement noise (setNoise): gaussian per conversion, sigma shrinking with sqrt(oversampling), deterministic
+	 - IIR filter (config register) on temperature and pressure, restarting with the first conversion after a soft
+	   reset or filter change (DS 3.4.4)
+	 - bus traffic: transactions, bytes in both directions and the resulting wire time at the configured clock
+	   (1 start + 9 bit per byte incl. ack + 1 stop per transaction)
+	Faults:
+	 - NACK of the next n transactions (endTransmission() returns 2, requestFrom() returns 0, reads yield 0xFF)
+	 - stuck busy bits in the status register
+
+	Time is taken from the accumulated wire time plus advance(), unless a time source (e.g. micros) is set.
+ */
+
+#define BME280_SIM_STARTUP_US 2000
+
+// Raw content of the calibration registers as read from a device
+typedef struct {
+	uint8_t cal1[26];   ///< 0x88..0xA1
+	uint8_t cal2[7];    ///< 0xE1..0xE7
+} bme280_sim_dump;
+
+extern const bme280_sim_dump kBME280SimDefaultDump;
+
+class BME280Sim {
+public:
+	struct stats_s {
+		uint32_t transactions;   ///< completed start..stop sequences
+		uint32_t bytesWritten;   ///< bytes sent to the device, excluding address bytes
+		uint32_t bytesRead;      ///< bytes returned by the device
+		uint32_t nacks;          ///< transactions that were not acknowledged
+		uint32_t busTimeUs;      ///< accumulated wire time
+	};
+
+	explicit BME280Sim(uint8_t addr = 0x76, const bme280_sim_dump &dump = kBME280SimDefaultDump);
+
+	// TwoWire compatible part
+	void begin();
+	void setClock(uint32_t frequency);
+	void beginTransmission(uint8_t addr);
+	auto write(uint8_t data) -> size_t;
+	auto endTransmission(bool sendStop = true) -> uint8_t;
+	auto requestFrom(uint8_t addr, uint8_t len) -> uint8_t;
+	auto available() -> int;
+	auto read() -> int;
+
+	// Simulation control
+	void loadDump(const bme280_sim_dump &dump);
+	void setRawSample(uint32_t adcT, uint32_t adcP, uint16_t adcH);
+	// Standard deviation in ADC counts at oversampling x1, 0 => exact samples. seed makes runs repeatable.
+	void setNoise(float sigmaT, float sigmaP, float sigmaH, uint32_t seed = 1);
+	void setTimeSource(uint32_t (*nowUs)());
+	void advance(uint32_t us);
+	void nackNext(uint32_t count);
+	void setStuckBusy(bool stuck);
+
+	auto stats() const -> const stats_s &;
+	void resetStats();
+
+	auto reg(uint8_t addr) const -> uint8_t;
+
+private:
+	auto now() -> uint32_t;
+	void account(uint32_t dataBytes);
+	auto nackPending() -> bool;
+	auto readRegister(uint8_t addr) -> uint8_t;
+	void writeRegister(uint8_t addr, uint8_t value);
+	void softReset();
+	void update();
+	void convert();
+	auto conversionUs() const -> uint32_t;
+	auto standbyUs() const -> uint32_t;
+	auto gaussian() -> float;
+
+	uint8_t m_addr;
+	uint8_t m_regs[256];
+	uint8_t m_pointer;   //!< register pointer, auto increments on access
+
+	// Pending transmission
+	bool    m_txActive;
+	bool    m_txForUs;
+	bool    m_txHavePointer;
+	uint8_t m_txBytes;
+
+	// Pending read
+	uint8_t m_rxLeft;
+	bool    m_rxNack;
+
+	uint32_t m_clock;
+	uint32_t m_simTimeUs;
+	uint32_t (*m_timeSource)();
+	uint32_t m_busyUntil;
+	uint32_t m_measuringUntil;   //!< end of the pending forced conversion
+	bool     m_forcedPending;
+	uint32_t m_cycleStart;    //!< normal mode was entered
+	uint32_t m_conversions;   //!< normal mode conversions latched since m_cycleStart
+	int32_t  m_adc[3];        //!< raw sample, data register order: pressure, temperature, humidity
+	float    m_noise[3];      //!< sigma at x1, same order
+	uint32_t m_rng;
+	int32_t  m_filtered[2];   //!< IIR state of pressure and temperature
+	bool     m_filterStarted;
+	uint32_t m_nackCount;
+	bool     m_stuckBusy;
+
+	stats_s m_stats;
+};
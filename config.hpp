@@ -5,11 +5,100 @@
 
 #define DEBUG
 #define DEBUG_BAUDRATE 115200
+// Deferred log (debug.hpp): entries up to LOG_LEVEL (1 = error .. 4 = debug) of the modules in LOG_MODULES are kept,
+// the last LOG_RING_ENTRIES are printed at the end of the wake. LOG_BINARY prints them as hex for logdecode.py.
+#define LOG_LEVEL 4
+#define LOG_MODULES 0xff
+#define LOG_RING_ENTRIES 64
+//#define LOG_BINARY
+
+// BME280 is attached via I2C (address 0x76) by default, define to use SPI with the given chip select pin instead
+//#define USE_BME_SPI
+#define BME_SPI_CS 15
+// Replace the sensor by the register level simulation in bme280_sim.hpp, logs the bus cost of each wake
+//#define USE_SIM_SENSOR
 
 #define SSID "<SSID>"
 #define PSK "<PSK>"
 #define DB_URL "http://<host>:8086/write?db=envsensors"
 #define TS_URL "http://<host>:8000/"
 
+// Upload to DB_URL (then https://...) via TLS. The server key is pinned to TLS_PUBKEY instead of validating its chain
+// and the session is cached in RTC memory, so upload wakes after the first one only do an abbreviated handshake.
+// Get the key with: openssl x509 -in cert.pem -pubkey -noout
+//#define USE_TLS
+#define TLS_PUBKEY "-----BEGIN PUBLIC KEY-----\n<key>\n-----END PUBLIC KEY-----\n"
+
+// Pull new builds from OTA_URL (timeserver.py /firmware) on upload wakes, as gzip image or delta against the running
+// build (see ota_pull.hpp). Only every OTA_CHECK_BATCHES uploaded batches, as hashing the running build takes a while.
+//#define USE_PULL_OTA
+#define OTA_URL "http://<host>:8000/firmware"
+#define OTA_CHECK_BATCHES 16
+
+// Number of APs (BSSID + channel) for SSID remembered in RTC memory and the time given to each to associate before
+// trying the next. DHCP gets WIFI_DHCP_MS after association, connecting as a whole at most WIFI_CONNECT_MS.
+#define WIFI_AP_CACHE 4
+#define WIFI_ATTEMPT_MS 1000
+#define WIFI_DHCP_MS 1000
+#define WIFI_CONNECT_MS 5000
+
+// Send stored records to a gateway node via ESP-NOW (see espnow_link.hpp), only associate if it doesn't ack them.
+// USE_ESPNOW_GATEWAY builds the mains powered gateway instead: no sensor, no sleep, USE_OTA is ignored.
+// ESPNOW_GATEWAY_MAC is the gateway's station MAC, ESPNOW_CHANNEL its AP's channel (0 => the best cached AP's one).
+//#define USE_ESPNOW
+//#define USE_ESPNOW_GATEWAY
+#define ESPNOW_GATEWAY_MAC {0x00, 0x00, 0x00, 0x00, 0x00, 0x00}
+#define ESPNOW_CHANNEL 0
+// The gateway only acks once influx stored the batch, ESPNOW_ACK_MS has to cover its write
+#define ESPNOW_ACK_MS 500
+#define ESPNOW_RETRIES 3
+// Gateway: nodes whose last batch is remembered, batches queued for forwarding
+#define GATEWAY_NODES 32
+#define GATEWAY_QUEUE 8
+#define GATEWAY_RESYNC_MS 3600000
+
+// Upper bound for the time a wake takes (since boot), and for each of its phases, see wake_budget.hpp
+#define WAKE_BUDGET_MS 10000
+#define BUDGET_SENSOR_MS 500
+#define BUDGET_ASSOC_MS 5000
+#define BUDGET_TIMESYNC_MS 1500
+#define BUDGET_UPLOAD_MS 5000
+// Not capped by WAKE_BUDGET_MS, see USE_PULL_OTA
+#define BUDGET_UPDATE_MS 60000
+
+// USE_OTA builds only: serve stored records on METRICS_PORT for pull based collection (see metrics_server.hpp)
+// With METRICS_PULL_ONLY nothing is pushed to DB_URL anymore
+//#define USE_METRICS_SERVER
+//#define METRICS_PULL_ONLY
+#define METRICS_PORT 80
+#define METRICS_TIMEOUT_MS 200
+
 #define INTERVAL_MS 20000
+#ifdef USE_TLS
+// The cached TLS session takes up part of the RTC memory
+#define STORED_RECORDS 20
+#else
 #define STORED_RECORDS 30
+#endif
+// Upload once more than this many records are stored
+#define RECORD_LIMIT (STORED_RECORDS - 10)
+// Records are uploaded in requests of about this size, see loadgen.py for tuning against the server
+#define UPLOAD_CHUNK_BYTES 512
+
+// BME280 oversampling (0 = skipped, 1 = x1, 2 = x2, 3 = x4, 4 = x8, 5 = x16) and IIR filter (0 = off .. 4 = x16)
+#define BME_OSRS_T 4
+#define BME_OSRS_P 3
+#define BME_OSRS_H 3
+#define BME_FILTER 0
+
+// Calibration build: on power on/reset measure noise and conversion time of the oversampling/filter profiles and store
+// the cheapest one meeting the noise targets in flash (see sensor_tuner.hpp), it then replaces the BME settings above.
+// Targets are standard deviations in .001 DegC, .01 Pa and .01 %RH.
+//#define USE_SENSOR_TUNING
+#define TUNE_SAMPLES 16
+#define TUNE_NOISE_T 20
+#define TUNE_NOISE_P 150
+#define TUNE_NOISE_H 10
+
+// INTERVAL_MS, RECORD_LIMIT, UPLOAD_CHUNK_BYTES, WIFI_ATTEMPT_MS and the BME settings above are only defaults,
+// the server can override them at runtime, see runtime_config.hpp
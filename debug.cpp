@@ -2,9 +2,77 @@
 
 #include "debug.hpp"
 
-unsigned lastMillis = 0;
 uint32_t lastCycles = 0;
 
+#ifdef DEBUG
+namespace deferredLog {
+namespace {
+entry    ring[LOG_RING_ENTRIES];
+uint16_t first   = 0;
+uint16_t count   = 0;
+uint32_t dropped = 0;
+
+const char* const kModuleNames[] = {"main", "rtc", "wifi", "net", "sensor", "cfg"};
+}   // namespace
+
+void push(uint8_t level, uint8_t module, const char* fmt, uint8_t argc, const uint32_t* args) {
+	// Keep the newest entries, they are the ones leading up to whatever went wrong
+	if (count == LOG_RING_ENTRIES) {
+		first = (first + 1) % LOG_RING_ENTRIES;
+		count--;
+		dropped++;
+	}
+	entry& e = ring[(first + count) % LOG_RING_ENTRIES];
+	e.fmt    = fmt;
+	e.us     = micros();
+	e.level  = level;
+	e.module = module;
+	e.argc   = argc;
+	memcpy(e.args, args, argc * sizeof(uint32_t));
+	count++;
+}
+
+static auto moduleName(uint8_t module) -> const char* {
+	for (uint8_t i = 0; i < sizeof(kModuleNames) / sizeof(kModuleNames[0]); i++) {
+		if (module & (1 << i)) {
+			return kModuleNames[i];
+		}
+	}
+	return "?";
+}
+
+void flush() {
+	if (dropped) {
+		Serial.printf("... %u older log entries dropped\n", dropped);
+	}
+	for (; count > 0; count--, first = (first + 1) % LOG_RING_ENTRIES) {
+		entry const& e = ring[first];
+#ifdef LOG_BINARY
+		// Format is resolved by logdecode.py, see there
+		Serial.printf("#DL %x %u %u %u", reinterpret_cast<uintptr_t>(e.fmt), e.us, e.level, e.module);
+		for (uint8_t i = 0; i < e.argc; i++) {
+			Serial.printf(" %x", e.args[i]);
+		}
+#else
+		Serial.printf("%10u %c %-6s ", e.us, "?EWID"[e.level], moduleName(e.module));
+		// Unused arguments are just ignored by printf
+		Serial.printf_P(e.fmt, e.args[0], e.args[1], e.args[2], e.args[3], e.args[4], e.args[5]);
+#endif
+		Serial.println();
+	}
+	first   = 0;
+	dropped = 0;
+	Serial.flush();
+}
+}   // namespace deferredLog
+#endif
+
+void log_flush() {
+#ifdef DEBUG
+	deferredLog::flush();
+#endif
+}
+
 void init_debug() {
 #ifdef DEBUG
 	Serial.begin(DEBUG_BAUDRATE);
@@ -18,15 +86,12 @@ void init_debug() {
 
 #ifdef DEBUG
 void loginter(const char* name) {
-	unsigned newMillis = millis();
-	uint32_t cycles    = ESP.getCycleCount();
-	if (lastMillis == 0) {
-		lastMillis = newMillis;
+	uint32_t cycles = ESP.getCycleCount();
+	if (lastCycles == 0) {
 		lastCycles = cycles;
 	}
-	LOGF(">>>TIME: %6d (+ %5d) | Cycle %14d (+ %11d) %s\n", newMillis, newMillis - lastMillis, cycles, cycles - lastCycles, name);
-	// Reread out time in order to not include LOGF call
-	lastMillis = millis();
-	lastCycles = ESP.getCycleCount();
+	// The entry itself carries the time, as logging no longer blocks there is no need to exclude it from the next delta
+	LOGI(LOG_MOD_MAIN, ">>>TIME: Cycle %10u (+ %9u) %s", cycles, cycles - lastCycles, name);
+	lastCycles = cycles;
 }
-#endif
\ No newline at end of file
+#endif
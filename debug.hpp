@@ -1,6 +1,17 @@
 #pragma once
+#include <Arduino.h>
+
+#include <type_traits>
+
 #include "config.hpp"
 
+// References the arguments of compiled out log statements, so variables only logged don't warn as unused
+template <typename... Args>
+inline void log_unused(const Args&...) {
+}
+
+// Synchronous output, blocks on the UART. Only meant for cold paths (sensor not found, calibration dump, ...),
+// everything on the wake path goes through the deferred log below.
 #ifdef DEBUG
 #define LOG Serial.print
 #define LOGF Serial.printf
@@ -12,13 +23,13 @@ void loginter(const char* name);
 	while (0) {    \
 		(void)(x); \
 	}
-#define LOGF(x, ...) \
-	while (0) {      \
-		(void)(x);   \
+#define LOGF(x, ...)                 \
+	while (0) {                      \
+		log_unused(x, ##__VA_ARGS__); \
 	}
-#define LOGLN(x, ...) \
-	while (0) {       \
-		(void)(x);    \
+#define LOGLN(x, ...)                \
+	while (0) {                      \
+		log_unused(x, ##__VA_ARGS__); \
 	}
 #define LOGINTER(x) \
 	while (0) {     \
@@ -26,17 +37,95 @@ void loginter(const char* name);
 	}
 #endif
 
+/*
+	Deferred log: LOGE/LOGW/LOGI/LOGD(module, fmt, args...) only store the format pointer, micros() and up to
+	LOG_MAX_ARGS 32 bit arguments in a RAM ring (a few us), formatting and the UART happen in log_flush()
+	at the end of the wake. With LOG_BINARY the entries are dumped as hex and rendered by logdecode.py from the ELF.
+
+	Formats live in flash (PSTR) and have no trailing newline. Arguments are integers or pointers to string
+	literals, anything else (String::c_str(), buffers) is gone by the time the entry is rendered.
+	Entries above LOG_LEVEL or of modules not in LOG_MODULES (config.hpp) are compiled out.
+ */
+#define LOG_LVL_ERROR 1
+#define LOG_LVL_WARN 2
+#define LOG_LVL_INFO 3
+#define LOG_LVL_DEBUG 4
+
+// Keep in sync with MODULES in logdecode.py
+#define LOG_MOD_MAIN 0x01
+#define LOG_MOD_RTC 0x02
+#define LOG_MOD_WIFI 0x04
+#define LOG_MOD_NET 0x08
+#define LOG_MOD_SENSOR 0x10
+#define LOG_MOD_CFG 0x20
+
+#define LOG_MAX_ARGS 6
+
+#ifdef DEBUG
+#define DLOG(level, module, fmt, ...)                                  \
+	do {                                                               \
+		if ((level) <= LOG_LEVEL && ((module)&LOG_MODULES)) {          \
+			deferredLog::log(level, module, PSTR(fmt), ##__VA_ARGS__); \
+		}                                                              \
+	} while (0)
+#else
+#define DLOG(level, module, fmt, ...)   \
+	while (0) {                         \
+		log_unused(fmt, ##__VA_ARGS__); \
+	}
+#endif
+#define LOGE(module, fmt, ...) DLOG(LOG_LVL_ERROR, module, fmt, ##__VA_ARGS__)
+#define LOGW(module, fmt, ...) DLOG(LOG_LVL_WARN, module, fmt, ##__VA_ARGS__)
+#define LOGI(module, fmt, ...) DLOG(LOG_LVL_INFO, module, fmt, ##__VA_ARGS__)
+#define LOGD(module, fmt, ...) DLOG(LOG_LVL_DEBUG, module, fmt, ##__VA_ARGS__)
+
+namespace deferredLog {
+typedef struct {
+	const char* fmt;   // PSTR
+	uint32_t    us;    // micros() when logged
+	uint8_t     level;
+	uint8_t     module;
+	uint8_t     argc;
+	uint32_t    args[LOG_MAX_ARGS];
+} entry;
+
+void push(uint8_t level, uint8_t module, const char* fmt, uint8_t argc, const uint32_t* args);
+
+template <typename T>
+inline auto arg(T value) -> uint32_t {
+	static_assert(std::is_integral<T>::value || std::is_enum<T>::value || std::is_pointer<T>::value,
+				  "Deferred log arguments are integers or pointers to string literals");
+	// Entries have one 32 bit slot per argument, log 64 bit values as two halves
+	static_assert(std::is_pointer<T>::value || sizeof(T) <= sizeof(uint32_t), "Deferred log arguments are at most 32 bit");
+	if constexpr (std::is_pointer<T>::value) {
+		return static_cast<uint32_t>(reinterpret_cast<uintptr_t>(value));
+	} else {
+		return static_cast<uint32_t>(value);
+	}
+}
+
+template <typename... Args>
+inline void log(uint8_t level, uint8_t module, const char* fmt, Args... args) {
+	static_assert(sizeof...(Args) <= LOG_MAX_ARGS, "Too many arguments for a deferred log entry");
+	uint32_t const packed[sizeof...(Args) + 1] = {arg(args)...};
+	push(level, module, fmt, sizeof...(Args), packed);
+}
+}   // namespace deferredLog
+
+// Renders the buffered entries and waits for the UART, call before sleeping
+void log_flush();
+
 class LOGFUNC {
 public:
 	explicit LOGFUNC(const char* name) : m_name(name) {
-		loginter(name);
+		LOGINTER(name);
 	};
 	~LOGFUNC() {
-		loginter(m_name);
+		LOGINTER(m_name);
 	}
 
 private:
 	const char* m_name;
 };
 
-void init_debug();
\ No newline at end of file
+void init_debug();
@@ -0,0 +1,269 @@
+#include "espnow_link.hpp"
+
+#if defined(USE_ESPNOW) || defined(USE_ESPNOW_GATEWAY)
+#include <espnow.h>
+
+#include <algorithm>
+
+#include "debug.hpp"
+#include "wake_budget.hpp"
+
+// SDK callbacks run in the system task, which only gets scheduled when loop() yields (delay, yield, returning),
+// so they never interrupt the code below and the shared state needs no locking.
+
+#ifdef USE_ESPNOW
+namespace espNowLink {
+namespace {
+uint8_t gatewayMac[6] = ESPNOW_GATEWAY_MAC;
+
+volatile bool acked     = false;
+uint16_t      waitSeq   = 0;
+uint16_t      waitBoot  = 0;
+uint32_t      waitFirst = 0;
+uint8_t       waitCount = 0;
+msec_timespec ackAnchor;
+
+void onReceive(uint8_t* mac, uint8_t* data, uint8_t len) {
+	if (len != sizeof(espnowAck) || memcmp(mac, gatewayMac, sizeof(gatewayMac)) != 0) {
+		return;
+	}
+	espnowAck ack;
+	memcpy(&ack, data, sizeof(ack));
+	// Acks are broadcast, most of them are for other nodes
+	if (ack.type != ESPNOW_TYPE_ACK || ack.chip_id != ESP.getChipId() || ack.boot_id != waitBoot || ack.batch_seq != waitSeq) {
+		return;
+	}
+	// Late ack for an earlier send of this batch_seq, which held other records
+	if (ack.first_seq != waitFirst || ack.count != waitCount) {
+		return;
+	}
+	ackAnchor = ack.anchor;
+	acked     = true;
+}
+}   // namespace
+
+auto begin() -> bool {
+	if (esp_now_init() != 0) {
+		LOGE(LOG_MOD_NET, "ESP-NOW init failed");
+		return false;
+	}
+	// Sends batches and receives acks
+	esp_now_set_self_role(ESP_NOW_ROLE_COMBO);
+	esp_now_register_recv_cb(onReceive);
+	return esp_now_add_peer(gatewayMac, ESP_NOW_ROLE_COMBO, WiFi.channel(), nullptr, 0) == 0;
+}
+
+auto send(const espnowBatch& batch, uint8_t count, msec_timespec& anchor) -> bool {
+	uint8_t const len = sizeof(espnowBatchHeader) + count * sizeof(sensor_data);
+	waitSeq           = batch.header.batch_seq;
+	waitBoot          = batch.header.boot_id;
+	waitFirst         = batch.header.first_seq;
+	waitCount         = count;
+	for (uint8_t attempt = 0; attempt < ESPNOW_RETRIES && !wakeBudget::expired(); attempt++) {
+		acked                = false;
+		uint32_t const start = millis();
+		if (esp_now_send(gatewayMac, reinterpret_cast<uint8_t*>(const_cast<espnowBatch*>(&batch)), len) != 0) {
+			LOGW(LOG_MOD_NET, "ESP-NOW send of batch %u failed", waitSeq);
+			continue;
+		}
+		while (!acked && millis() - start < ESPNOW_ACK_MS) {
+			delay(1);
+		}
+		if (acked) {
+			LOGD(LOG_MOD_NET, "Batch %u (%d records) acked after %d ms", waitSeq, count, millis() - start);
+			anchor = ackAnchor;
+			return true;
+		}
+	}
+	LOGW(LOG_MOD_NET, "Gateway didn't ack batch %u", waitSeq);
+	return false;
+}
+
+void end() {
+	esp_now_unregister_recv_cb();
+	esp_now_deinit();
+}
+}   // namespace espNowLink
+#endif
+
+#ifdef USE_ESPNOW_GATEWAY
+namespace espNowGateway {
+namespace {
+uint8_t kBroadcast[6] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+
+// Per node the records forwarded so far and the ack for the last batch, so a resent batch is acked again (or only
+// its new records are forwarded) without storing anything twice
+typedef struct {
+	uint32_t      chip_id;
+	uint16_t      boot_id;
+	uint16_t      batch_seq;   // Last batch acked
+	uint32_t      first_seq;   // Its first record
+	uint32_t      next_seq;    // record_seq after the newest record forwarded with this boot_id
+	msec_timespec anchor;      // Timestamp of first_seq
+	uint8_t       count;       // Records of the last batch
+	bool          due;         // ack has to be sent (again)
+} lastAck;
+
+lastAck acks[GATEWAY_NODES];
+uint8_t nextAck = 0;
+
+espnowBatch queue[GATEWAY_QUEUE];
+uint8_t     first   = 0;
+uint8_t     queued  = 0;
+uint32_t    dropped = 0;
+
+msec_timespec timeBase   = {0, 0};
+uint32_t      timeMillis = 0;
+
+auto now() -> msec_timespec {
+	auto ts = timeBase;
+	ts.add(millis() - timeMillis);
+	return ts;
+}
+
+auto sameNode(const espnowBatchHeader& a, uint32_t chip_id, uint16_t boot_id) -> bool {
+	return a.chip_id == chip_id && a.boot_id == boot_id;
+}
+
+auto sameBatch(const espnowBatchHeader& a, const espnowBatchHeader& b) -> bool {
+	return sameNode(a, b.chip_id, b.boot_id) && a.batch_seq == b.batch_seq && a.first_seq == b.first_seq && a.count == b.count;
+}
+
+// Timestamp of record seq, given the one of record ref_seq. Records of a node are interval_ms apart.
+auto timestampOf(msec_timespec ref, uint32_t ref_seq, uint32_t seq, uint32_t interval_ms) -> msec_timespec {
+	if (seq >= ref_seq) {
+		ref.add((seq - ref_seq) * interval_ms);
+	} else {
+		ref.subtract((ref_seq - seq) * interval_ms);
+	}
+	return ref;
+}
+
+auto findAck(uint32_t chip_id) -> lastAck* {
+	for (auto& entry : acks) {
+		if (entry.chip_id == chip_id) {
+			return &entry;
+		}
+	}
+	return nullptr;
+}
+
+// SDK callback: no sending and no logging here, gateway_loop does both
+void onReceive(uint8_t* mac, uint8_t* data, uint8_t len) {
+	if (len < sizeof(espnowBatchHeader) || len > sizeof(espnowBatch) || !timeBase.is_set()) {
+		return;
+	}
+	espnowBatch batch;
+	memcpy(&batch, data, len);
+	auto& header = batch.header;
+	if (header.type != ESPNOW_TYPE_BATCH || header.count > ESPNOW_BATCH_RECORDS ||
+		len != sizeof(espnowBatchHeader) + header.count * sizeof(sensor_data)) {
+		return;
+	}
+
+	// Records of this node up to end are forwarded or will be, with their timestamps relative to ref
+	auto*         entry   = findAck(header.chip_id);
+	bool const    known   = entry != nullptr && entry->boot_id == header.boot_id;
+	uint32_t      end     = known ? entry->next_seq : 0;
+	uint32_t      ref_seq = known ? entry->first_seq : 0;
+	msec_timespec ref     = known ? entry->anchor : msec_timespec{0, 0};
+	if (known && header.first_seq + header.count <= end) {
+		// Resent after a lost ack, nothing new in it
+		entry->batch_seq = header.batch_seq;
+		entry->anchor    = header.anchor.is_set() ? header.anchor : timestampOf(ref, ref_seq, header.first_seq, header.interval_ms);
+		entry->first_seq = header.first_seq;
+		entry->count     = header.count;
+		entry->due       = true;
+		return;
+	}
+	for (uint8_t i = 0; i < queued; i++) {
+		auto const& other = queue[(first + i) % GATEWAY_QUEUE].header;
+		if (sameBatch(other, header)) {
+			// Acked once forwarded
+			return;
+		}
+		if (sameNode(other, header.chip_id, header.boot_id)) {
+			end     = std::max(end, other.first_seq + other.count);
+			ref_seq = other.first_seq;
+			ref     = other.anchor;
+		}
+	}
+	// No ack, the node retries and eventually uploads itself
+	if (queued == GATEWAY_QUEUE) {
+		dropped++;
+		return;
+	}
+	// Records forwarded already only need the ack. Wider than valid, so none of them is forwarded twice.
+	for (uint8_t i = 0; i < header.count && header.first_seq + i < end; i++) {
+		header.valid &= ~(1UL << i);
+	}
+	if (!header.anchor.is_set()) {
+		if (ref.is_set()) {
+			header.anchor = timestampOf(ref, ref_seq, header.first_seq, header.interval_ms);
+		} else {
+			header.anchor = now();
+			header.anchor.subtract(header.newest_offset * header.interval_ms);
+		}
+	}
+	queue[(first + queued) % GATEWAY_QUEUE] = batch;
+	queued++;
+}
+}   // namespace
+
+auto begin() -> bool {
+	if (esp_now_init() != 0) {
+		LOGE(LOG_MOD_NET, "ESP-NOW init failed");
+		return false;
+	}
+	esp_now_set_self_role(ESP_NOW_ROLE_COMBO);
+	esp_now_register_recv_cb(onReceive);
+	// Channel 0 => the one of the AP we're associated with
+	return esp_now_add_peer(kBroadcast, ESP_NOW_ROLE_COMBO, 0, nullptr, 0) == 0;
+}
+
+void setTime(const msec_timespec& ts) {
+	timeBase   = ts;
+	timeMillis = millis();
+}
+
+auto timeSetAt() -> uint32_t {
+	return timeBase.is_set() ? timeMillis : 0;
+}
+
+auto peek(uint8_t index) -> const espnowBatch* {
+	return index < queued ? &queue[(first + index) % GATEWAY_QUEUE] : nullptr;
+}
+
+void ack(uint8_t count) {
+	for (; count > 0 && queued > 0; count--) {
+		auto const& header = queue[first].header;
+		auto*       entry  = findAck(header.chip_id);
+		if (entry == nullptr) {
+			entry   = &acks[nextAck];
+			nextAck = (nextAck + 1) % GATEWAY_NODES;
+		}
+		uint32_t next_seq = header.first_seq + header.count;
+		if (entry->chip_id == header.chip_id && entry->boot_id == header.boot_id) {
+			next_seq = std::max(next_seq, entry->next_seq);
+		}
+		*entry = {header.chip_id, header.boot_id, header.batch_seq, header.first_seq, next_seq, header.anchor, header.count, true};
+		first  = (first + 1) % GATEWAY_QUEUE;
+		queued--;
+	}
+}
+
+auto sendAcks() -> uint32_t {
+	for (auto& entry : acks) {
+		if (entry.due) {
+			espnowAck ack = {ESPNOW_TYPE_ACK, entry.count, entry.batch_seq, entry.chip_id, entry.anchor, entry.boot_id, 0, entry.first_seq};
+			esp_now_send(kBroadcast, reinterpret_cast<uint8_t*>(&ack), sizeof(ack));
+			entry.due = false;
+		}
+	}
+	uint32_t const result = dropped;
+	dropped               = 0;
+	return result;
+}
+}   // namespace espNowGateway
+#endif
+#endif
@@ -0,0 +1,98 @@
+#pragma once
+
+// Before config.hpp, SSID is also a method of the WiFi classes
+#include <ESP8266WiFi.h>
+
+#include "bme280_aggregator.hpp"
+#include "config.hpp"
+#include "msec_timespec.hpp"
+
+/*
+	ESP-NOW link between sensor nodes (USE_ESPNOW) and a mains powered gateway node (USE_ESPNOW_GATEWAY):
+	 - a node only wakes the radio on the gateway's channel, no association, DHCP or TCP. It sends its stored
+	   records from the upload cursor in espnowBatch frames and waits ESPNOW_ACK_MS for the ack of each one.
+	 - the gateway queues a batch, timestamps its records and forwards them to DB_URL over a connection that stays
+	   open (see gateway_loop in wlan_sketch.ino). Only once influx took them the batch is acked, so the node keeps
+	   its records until they are stored. With influx unreachable the queue fills up and further batches go unacked,
+	   the nodes then upload themselves or retry later.
+	 - the ack carries the timestamp the gateway used for the first record, the node keeps it as its anchor.
+	 - records are identified by chip ID + boot ID (gRTC.boot_id, record_seq starts over with it) + record_seq. The
+	   gateway remembers per node up to which record it forwarded: a batch resent after a lost ack is acked again,
+	   one that gained records meanwhile (same batch_seq, batch_seq only advances on acks) only has the new ones
+	   forwarded, timestamped consistently with the ones before, and is acked once those are stored.
+	An ack names batch_seq, first_seq and count of the batch it is for, a late ack for an earlier send of the same
+	batch_seq doesn't release records it didn't cover.
+	Acks are broadcast, so the gateway needs no peer entry per node. Frames are not encrypted.
+ */
+#define ESPNOW_MAX_FRAME 250
+#define ESPNOW_TYPE_BATCH 1
+#define ESPNOW_TYPE_ACK 2
+
+typedef struct {
+	uint8_t       type;            // ESPNOW_TYPE_BATCH
+	uint8_t       count;           // Records in this frame
+	uint8_t       newest_offset;   // Intervals from the first record to the one taken this wake
+	uint8_t       reserved;
+	uint16_t      batch_seq;
+	uint16_t      boot_id;
+	uint32_t      chip_id;
+	uint32_t      interval_ms;
+	uint32_t      valid;       // Bitmask of records that weren't lost to a corrupted RTC block
+	msec_timespec anchor;      // Timestamp of the first record, unset => the gateway assigns one
+	uint32_t      first_seq;   // record_seq of the first record
+} espnowBatchHeader;
+
+#define ESPNOW_BATCH_RECORDS ((ESPNOW_MAX_FRAME - sizeof(espnowBatchHeader)) / sizeof(sensor_data))
+
+typedef struct {
+	espnowBatchHeader header;
+	sensor_data       records[ESPNOW_BATCH_RECORDS];
+} espnowBatch;
+
+typedef struct {
+	uint8_t       type;    // ESPNOW_TYPE_ACK
+	uint8_t       count;   // Records of the acked batch, all of them are stored
+	uint16_t      batch_seq;
+	uint32_t      chip_id;
+	msec_timespec anchor;   // Timestamp the gateway used for the first record
+	uint16_t      boot_id;
+	uint16_t      reserved;
+	uint32_t      first_seq;
+} espnowAck;
+
+static_assert(sizeof(espnowBatchHeader) == 32 && sizeof(espnowAck) == 24, "ESP-NOW frames differ between builds");
+static_assert(sizeof(espnowBatch) <= ESPNOW_MAX_FRAME, "ESP-NOW frame too large");
+static_assert(ESPNOW_BATCH_RECORDS <= 32, "Valid bitmask exceeded");
+
+// Node side, the radio has to be on the gateway's channel (ESaveWifi::turnOnRadio)
+namespace espNowLink {
+auto begin() -> bool;
+
+// Sends the first count records of batch, true once the gateway acked it. anchor receives the timestamp of the first record.
+auto send(const espnowBatch& batch, uint8_t count, msec_timespec& anchor) -> bool;
+
+void end();
+}   // namespace espNowLink
+
+#ifdef USE_ESPNOW_GATEWAY
+// Gateway side, the SDK callback only queues batches. Forwarding and acks happen in loop().
+namespace espNowGateway {
+// WiFi has to be connected already, ESP-NOW runs on the AP's channel
+auto begin() -> bool;
+
+// Nothing is queued until the gateway knows the time, see gateway_loop
+void setTime(const msec_timespec& now);
+// millis() of the last setTime, 0 if never
+auto timeSetAt() -> uint32_t;
+
+// index-th oldest queued batch (header.anchor is set), nullptr if there are fewer
+auto peek(uint8_t index) -> const espnowBatch*;
+
+// The oldest count batches were forwarded: acks them and drops them from the queue
+void ack(uint8_t count);
+
+// Sends the acks due, also the repeated ones for resent batches. Returns the batches dropped for a full queue since
+// the last call.
+auto sendAcks() -> uint32_t;
+}   // namespace espNowGateway
+#endif
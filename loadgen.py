@@ -0,0 +1,306 @@
+import argparse
+import asyncio
+import itertools
+import math
+import random
+import ssl
+import time
+import weakref
+
+from aiohttp import ClientSession, ClientTimeout, TCPConnector, web
+
+"""
+	Fleet load generator for the ingest path (timeserver.py + influx /write)
+
+	Emulates N sensor nodes with the firmware's storage and upload logic (see rtc_mem.cpp and
+	send_records_to_influx in wlan_sketch.ino): ring buffer of STORED_RECORDS, flush once more than
+	RECORD_LIMIT are stored, timestamp anchor fetched from the time endpoint, chunks of UPLOAD_CHUNK_BYTES
+	that are only released on a 2xx. Line format mirrors sensor_data::printTo / msec_timespec::printTo.
+
+	By default a local stand-in for both endpoints is started, which can inject failures and counts
+	duplicate points. Point --influx-url and --ts-url at real services to load them instead.
+	Time is compressed by --speedup, so a 20 s interval with speedup 100 wakes every 200 ms.
+
+	Several values for --chunk-bytes / --record-limit run one scenario per combination.
+
+	With --tls-cert/--tls-key the stand-in serves https (USE_TLS builds) and counts full vs resumed
+	handshakes. The emulated nodes don't cache sessions, so they put the full handshake cost on the server.
+	--serve only runs the stand-in, to point real nodes at it. USE_TLS only covers DB_URL, the nodes still ask
+	TS_URL via plain http, so with TLS the stand-in serves that on --http-port (default --port + 1) as well:
+
+		openssl req -x509 -newkey rsa:2048 -nodes -keyout key.pem -out cert.pem -days 365 -subj /CN=stand-in
+		openssl x509 -in cert.pem -pubkey -noout    # TLS_PUBKEY
+		python3 loadgen.py --serve --bind 0.0.0.0 --tls-cert cert.pem --tls-key key.pem
+		# DB_URL https://<host>:8086/write?db=envsensors, TS_URL http://<host>:8087/
+"""
+
+
+def format_fixed(value, decimals):
+    # Same as printFixed in bme280_aggregator.hpp: sign separate, so -0.5 keeps it
+    scale = 10 ** decimals
+    return "%s%d.%0*d" % ("-" if value < 0 else "", abs(value) // scale, decimals, abs(value) % scale)
+
+
+def format_record(host, temp, press, hum, ts_ms):
+    # temp in .001 DegC, press in .01 Pa, hum in 1/10000
+    return "bme280,host=%d temperature=%s,pressure=%s,humidity=%s %d000000\n" % (
+        host, format_fixed(temp, 3), format_fixed(press, 2), format_fixed(hum, 4), ts_ms)
+
+
+class Stats:
+    def __init__(self):
+        self.requests = 0
+        self.failed = 0
+        self.bytes = 0
+        self.latencies = []
+
+    def add(self, latency, size, ok):
+        self.requests += 1
+        self.bytes += size
+        self.failed += not ok
+        self.latencies.append(latency)
+
+    def percentile(self, p):
+        if not self.latencies:
+            return 0.0
+        values = sorted(self.latencies)
+        return values[min(len(values) - 1, int(len(values) * p))] * 1000
+
+
+class Device:
+    def __init__(self, host, args, session, stats):
+        self.host = host
+        self.args = args
+        self.session = session
+        self.stats = stats
+        self.records = []   # oldest first, like the ring buffer viewed from first_record
+        self.anchor = None  # timestamp of records[0] in ms
+        self.batch_seq = 0
+        self.taken = 0
+        self.temp = random.randint(18000, 24000)
+        self.press = random.randint(9800000, 10200000)
+        self.hum = random.randint(3000, 6000)
+
+    def sample(self):
+        self.temp += random.randint(-20, 20)
+        self.press += random.randint(-500, 500)
+        self.hum = min(10000, max(0, self.hum + random.randint(-10, 10)))
+        if len(self.records) == self.args.stored_records:
+            self.release(1)
+        self.records.append((self.temp, self.press, self.hum))
+        self.taken += 1
+
+    def release(self, count):
+        del self.records[:count]
+        if not self.records:
+            self.anchor = None
+        elif self.anchor is not None:
+            self.anchor += count * self.args.interval_ms
+
+    async def request(self, method, url, data=None, headers=None):
+        start = time.monotonic()
+        body = b""
+        try:
+            async with self.session.request(method, url, data=data, headers=headers) as resp:
+                body = await resp.read()
+                ok = 200 <= resp.status < 300
+        except (OSError, asyncio.TimeoutError):
+            ok = False
+        self.stats.add(time.monotonic() - start, len(data or b"") + len(body), ok)
+        return ok, body
+
+    async def flush(self):
+        if random.random() < self.args.wifi_fail:
+            # Association failed, the backlog grows until the next attempt
+            return
+        if self.anchor is None:
+            ok, body = await self.request("GET", self.args.ts_url)
+            if not ok:
+                return
+            self.anchor = int(body.decode().split("\n")[0].strip()) - (len(self.records) - 1) * self.args.interval_ms
+        while self.records:
+            payload = ""
+            count = 0
+            ts = self.anchor
+            while count < len(self.records) and len(payload) < self.args.chunk_bytes:
+                payload += format_record(self.host, *self.records[count], ts)
+                ts += self.args.interval_ms
+                count += 1
+            ok, _ = await self.request("POST", self.args.influx_url, payload.encode(),
+                                       {"X-Batch-Seq": str(self.batch_seq)})
+            if not ok:
+                return
+            self.release(count)
+            self.batch_seq += 1
+
+    async def run(self, wakes):
+        period = self.args.interval_ms / 1000 / self.args.speedup
+        # Nodes were powered on at random points of the interval
+        await asyncio.sleep(random.uniform(0, period))
+        for _ in range(wakes):
+            wake = time.monotonic()
+            self.sample()
+            if len(self.records) > self.args.record_limit:
+                await self.flush()
+            jitter = random.uniform(-self.args.jitter_ms, self.args.jitter_ms) / 1000 / self.args.speedup
+            await asyncio.sleep(max(0.0, period + jitter - (time.monotonic() - wake)))
+
+
+class StandIn:
+    """Local influx /write + time endpoint, counts points and duplicates"""
+
+    def __init__(self, fail_rate, lost_ack, delay_ms, verbose=False):
+        self.fail_rate = fail_rate
+        self.lost_ack = lost_ack
+        self.delay_ms = delay_ms
+        self.verbose = verbose
+        self.points = 0
+        self.unique = set()
+        self.handshakes = {False: 0, True: 0}  # session_reused => count
+        self.connections = weakref.WeakSet()
+
+    def count_handshake(self, request):
+        # Several requests can share a connection, only count its first one
+        ssl_object = request.transport.get_extra_info("ssl_object") if request.transport else None
+        if ssl_object is None or ssl_object in self.connections:
+            return
+        self.connections.add(ssl_object)
+        self.handshakes[ssl_object.session_reused] += 1
+        if self.verbose:
+            print("%s: %s handshake" % (request.remote, "resumed" if ssl_object.session_reused else "full"))
+
+    async def write(self, request):
+        self.count_handshake(request)
+        body = await request.text()
+        if self.delay_ms:
+            await asyncio.sleep(self.delay_ms / 1000)
+        if random.random() < self.fail_rate:
+            return web.Response(status=503)
+        for line in body.splitlines():
+            series, _, ts = line.rpartition(" ")
+            self.points += 1
+            self.unique.add((series.split(" ")[0], ts))
+        if self.verbose:
+            print("%s: batch %s, %d lines" % (request.remote, request.headers.get("X-Batch-Seq"), len(body.splitlines())))
+        if random.random() < self.lost_ack:
+            # Written, but the node never learns about it and resends
+            return web.Response(status=503)
+        return web.Response(status=204)
+
+    async def time(self, request):
+        return web.Response(text=str(int(time.time() * 1000)))
+
+    async def start(self, bind, port, ssl_context=None, http_port=None):
+        app = web.Application()
+        app.add_routes([web.post("/write", self.write), web.get("/", self.time)])
+        self.runner = web.AppRunner(app, access_log=None)
+        await self.runner.setup()
+        await web.TCPSite(self.runner, bind, port, ssl_context=ssl_context).start()
+        if http_port:
+            await web.TCPSite(self.runner, bind, http_port).start()
+
+    async def stop(self):
+        await self.runner.cleanup()
+
+
+def server_ssl_context(args):
+    if not args.tls_cert:
+        return None
+    context = ssl.create_default_context(ssl.Purpose.CLIENT_AUTH)
+    context.load_cert_chain(args.tls_cert, args.tls_key)
+    return context
+
+
+async def serve(args):
+    stand_in = StandIn(args.server_fail, args.lost_ack, args.server_delay_ms, verbose=True)
+    http_port = (args.http_port or args.port + 1) if args.tls_cert else None
+    await stand_in.start(args.bind, args.port, server_ssl_context(args), http_port)
+    print("Stand-in listening on %s:%d (%s)" % (args.bind, args.port, "https" if args.tls_cert else "http"))
+    if http_port:
+        print("Stand-in listening on %s:%d (http, for TS_URL)" % (args.bind, http_port))
+    try:
+        await asyncio.Event().wait()
+    finally:
+        await stand_in.stop()
+
+
+async def scenario(args):
+    stand_in = None
+    if args.local:
+        stand_in = StandIn(args.server_fail, args.lost_ack, args.server_delay_ms)
+        await stand_in.start(args.bind, args.port, server_ssl_context(args))
+
+    stats = Stats()
+    # The stand-in certificate is self signed, the firmware pins the key instead of validating it as well
+    connector = TCPConnector(limit=args.max_connections, force_close=True, ssl=False if args.tls_cert else None)
+    async with ClientSession(connector=connector, timeout=ClientTimeout(total=5)) as session:
+        devices = [Device(1000000 + i, args, session, stats) for i in range(args.devices)]
+        start = time.monotonic()
+        await asyncio.gather(*(d.run(args.wakes) for d in devices))
+        elapsed = time.monotonic() - start
+
+    taken = sum(d.taken for d in devices)
+    backlog = sum(len(d.records) for d in devices)
+    print("chunk %5d  limit %3d | %7.1f req/s %9.0f B/s | p50 %6.1f ms p99 %6.1f ms | failed %5d"
+          % (args.chunk_bytes, args.record_limit, stats.requests / elapsed, stats.bytes / elapsed,
+             stats.percentile(0.5), stats.percentile(0.99), stats.failed), end="")
+    if stand_in:
+        amplification = stand_in.points / max(1, len(stand_in.unique))
+        print(" | %d points, write amplification %.3f, %d/%d records still buffered"
+              % (stand_in.points, amplification, backlog, taken), end="")
+        if args.tls_cert:
+            print(" | TLS handshakes %d full %d resumed" % (stand_in.handshakes[False], stand_in.handshakes[True]), end="")
+        print()
+        await stand_in.stop()
+    else:
+        print(" | %d/%d records still buffered" % (backlog, taken))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Emulate a fleet of sensor nodes against the ingest path")
+    parser.add_argument("--devices", type=int, default=500)
+    parser.add_argument("--wakes", type=int, default=60, help="wakes per device")
+    parser.add_argument("--interval-ms", type=int, default=20000, help="INTERVAL_MS")
+    parser.add_argument("--stored-records", type=int, default=30, help="STORED_RECORDS")
+    parser.add_argument("--record-limit", type=int, nargs="+", default=[20], help="RECORD_LIMIT")
+    parser.add_argument("--chunk-bytes", type=int, nargs="+", default=[512], help="UPLOAD_CHUNK_BYTES")
+    parser.add_argument("--speedup", type=float, default=100.0)
+    parser.add_argument("--jitter-ms", type=float, default=500.0, help="wake jitter")
+    parser.add_argument("--wifi-fail", type=float, default=0.02, help="probability a flush can't associate")
+    parser.add_argument("--max-connections", type=int, default=200)
+    parser.add_argument("--influx-url", help="default: local stand-in")
+    parser.add_argument("--ts-url", help="default: local stand-in")
+    parser.add_argument("--port", type=int, default=8086, help="port of the local stand-in")
+    parser.add_argument("--bind", default="127.0.0.1", help="address of the local stand-in")
+    parser.add_argument("--tls-cert", help="stand-in: serve https with this certificate (PEM)")
+    parser.add_argument("--tls-key", help="stand-in: key for --tls-cert (PEM)")
+    parser.add_argument("--http-port", type=int, help="--serve with --tls-cert: plain http port for TS_URL (default --port + 1)")
+    parser.add_argument("--serve", action="store_true", help="only run the stand-in, e.g. for real nodes")
+    parser.add_argument("--server-fail", type=float, default=0.01, help="stand-in: probability of a 503")
+    parser.add_argument("--lost-ack", type=float, default=0.01, help="stand-in: probability a write succeeds but fails the request")
+    parser.add_argument("--server-delay-ms", type=float, default=0.0, help="stand-in: processing delay")
+    args = parser.parse_args()
+    if bool(args.tls_cert) != bool(args.tls_key):
+        parser.error("--tls-cert and --tls-key go together")
+    if args.influx_url and not args.ts_url:
+        parser.error("--influx-url needs --ts-url, the stand-in only runs when both are local")
+
+    if args.serve:
+        asyncio.run(serve(args))
+        return
+
+    args.local = args.influx_url is None
+    if args.local:
+        scheme = "https" if args.tls_cert else "http"
+        args.influx_url = "%s://127.0.0.1:%d/write?db=envsensors" % (scheme, args.port)
+        args.ts_url = args.ts_url or "%s://127.0.0.1:%d/" % (scheme, args.port)
+
+    for chunk_bytes, record_limit in itertools.product(args.chunk_bytes, args.record_limit):
+        run = argparse.Namespace(**vars(args))
+        run.chunk_bytes = chunk_bytes
+        run.record_limit = record_limit
+        asyncio.run(scenario(run))
+
+
+if __name__ == "__main__":
+    main()
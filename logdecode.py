@@ -0,0 +1,110 @@
+import argparse
+import re
+import struct
+import sys
+
+"""
+	Renders the deferred log of LOG_BINARY builds (see debug.hpp)
+
+	The firmware prints each entry as
+		#DL <format address> <micros> <level> <module> <argument>...
+	with all numbers but micros/level/module in hex. Formats (and string literal arguments) are looked up
+	in the ELF of the same build, e.g. the one the Arduino IDE leaves in its build folder:
+
+		python3 logdecode.py wlan_sketch.ino.elf < serial.log
+		pio device monitor | python3 logdecode.py .pio/build/nodemcuv2/firmware.elf
+
+	Lines that aren't log entries are passed through unchanged.
+"""
+
+# Keep in sync with LOG_MOD_* in debug.hpp
+MODULES = ["main", "rtc", "wifi", "net", "sensor", "cfg"]
+LEVELS = "?EWID"
+
+SHT_NOBITS = 8
+CONVERSION = re.compile(r"%([-+ 0#]*)(\d*)(?:\.(\d+))?(?:hh|h|ll|l|z)?([diouxXcsp%])")
+
+
+class Elf:
+    """Just enough ELF32 (little endian, xtensa-lx106) to read strings by address"""
+
+    def __init__(self, path):
+        with open(path, "rb") as f:
+            self.data = f.read()
+        if self.data[:4] != b"\x7fELF" or self.data[4] != 1:
+            raise ValueError("%s is not a 32 bit ELF file" % path)
+        shoff, = struct.unpack_from("<I", self.data, 0x20)
+        shentsize, shnum = struct.unpack_from("<HH", self.data, 0x2E)
+        self.sections = []
+        for i in range(shnum):
+            _, sh_type, _, addr, offset, size = struct.unpack_from("<6I", self.data, shoff + i * shentsize)
+            if sh_type != SHT_NOBITS and addr != 0 and size != 0:
+                self.sections.append((addr, offset, size))
+
+    def string(self, address):
+        for addr, offset, size in self.sections:
+            if addr <= address < addr + size:
+                start = offset + address - addr
+                end = self.data.index(b"\0", start, offset + size)
+                return self.data[start:end].decode(errors="replace")
+        return None
+
+
+def render(fmt, args, elf):
+    args = iter(args)
+
+    def convert(match):
+        flags, width, precision, conv = match.groups()
+        if conv == "%":
+            return "%"
+        value = next(args, 0)
+        spec = "%" + flags + width + ("." + precision if precision else "")
+        if conv in "di":
+            return (spec + "d") % (value - (1 << 32) if value & 0x80000000 else value)
+        if conv == "u":
+            return (spec + "d") % value
+        if conv == "c":
+            return (spec + "c") % chr(value & 0xFF)
+        if conv == "s":
+            string = elf.string(value)
+            return (spec + "s") % (string if string is not None else "<0x%08x>" % value)
+        if conv == "p":
+            return "0x%08x" % value
+        return (spec + conv) % value
+
+    return CONVERSION.sub(convert, fmt)
+
+
+def decode(line, elf):
+    fields = line.split()
+    if len(fields) < 5 or fields[0] != "#DL":
+        return line
+    try:
+        address = int(fields[1], 16)
+        us, level, module = (int(f) for f in fields[2:5])
+        args = [int(f, 16) for f in fields[5:]]
+    except ValueError:
+        return line
+    fmt = elf.string(address)
+    if fmt is None:
+        text = "<unknown format 0x%08x> %s" % (address, " ".join(fields[5:]))
+    else:
+        text = render(fmt, args, elf)
+    name = next((MODULES[i] for i in range(len(MODULES)) if module & (1 << i)), "?")
+    return "%10u %c %-6s %s" % (us, LEVELS[level] if level < len(LEVELS) else "?", name, text)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Render LOG_BINARY output using the firmware ELF")
+    parser.add_argument("elf", help="ELF of the build that produced the log")
+    parser.add_argument("log", nargs="?", type=argparse.FileType("r", errors="replace"), default=sys.stdin,
+                        help="serial log, default: stdin")
+    args = parser.parse_args()
+
+    elf = Elf(args.elf)
+    for line in args.log:
+        print(decode(line.rstrip("\r\n"), elf), flush=True)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,123 @@
+#include "metrics_server.hpp"
+
+#include "debug.hpp"
+#include "rtc_mem.hpp"
+#include "runtime_config.hpp"
+#include "wake_budget.hpp"
+
+namespace {
+// Cursors are <boot_id>-<record_seq>, record_seq starts over whenever the RTC header is lost. A cursor from another
+// boot (or a bare number) can't be compared with the current sequence, 0 => everything stored.
+auto parseCursor(const char *cursor) -> uint32_t {
+	char               *end;
+	unsigned long const boot = strtoul(cursor, &end, 10);
+	if (end == cursor || *end != '-' || boot != rtcMem::gRTC.boot_id) {
+		return 0;
+	}
+	return strtoul(end + 1, nullptr, 10);
+}
+}   // namespace
+
+MetricsServer::MetricsServer() : m_server(METRICS_PORT) {
+}
+
+void MetricsServer::begin() {
+	m_server.begin();
+	LOGF("Metrics server listening on %d\n", METRICS_PORT);
+}
+
+void MetricsServer::handle() {
+	WiFiClient client = m_server.available();
+	if (!client) {
+		return;
+	}
+	client.setTimeout(METRICS_TIMEOUT_MS);
+	String request = client.readStringUntil('\n');
+	// None of the headers matter to us, just drain them
+	while (client.connected()) {
+		String header = client.readStringUntil('\n');
+		if (header.length() <= 1) {
+			break;
+		}
+	}
+	LOG("Metrics request: ");
+	LOGLN(request);
+
+	if (request.startsWith("GET /metrics")) {
+		serveMetrics(client);
+	} else if (request.startsWith("GET /influx")) {
+		int const idx = request.indexOf("since=");
+		serveInflux(client, idx >= 0 ? parseCursor(request.c_str() + idx + 6) : 0);
+	} else {
+		client.print("HTTP/1.1 404 Not Found\r\nConnection: close\r\n\r\n");
+	}
+	client.stop();
+}
+
+void MetricsServer::serveMetrics(WiFiClient &client) {
+	using rtcMem::gRTC;
+	client.print("HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nConnection: close\r\n\r\n");
+	client.printf("# TYPE bme280_buffered_records gauge\nbme280_buffered_records{host=\"%u\"} %d\n", ESP.getChipId(), gRTC.stored_records);
+	client.printf("# TYPE bme280_record_cursor counter\nbme280_record_cursor{host=\"%u\"} %u\n", ESP.getChipId(), gRTC.record_seq);
+	client.print("# TYPE bme280_wake_budget_blown gauge\n");
+	for (uint8_t i = 0; i < static_cast<uint8_t>(wakePhase::count); i++) {
+		client.printf("bme280_wake_budget_blown{host=\"%u\",phase=\"%s\"} %d\n",
+					  ESP.getChipId(),
+					  wakeBudget::name(static_cast<wakePhase>(i)),
+					  gRTC.budget_blown[i]);
+	}
+	if (gRTC.stored_records == 0) {
+		return;
+	}
+
+	auto record = rtcMem::record_at(gRTC.stored_records - 1);
+	if (record == nullptr) {
+		return;
+	}
+	// Timestamp is optional in the exposition format, leave it to the scraper if we don't know the time yet
+	char ts_string[24] = "";
+	if (gRTC.anchor.is_set()) {
+		auto ts = gRTC.anchor;
+		ts.add((gRTC.stored_records - 1) * runtimeConfig::current().interval_ms);
+		ts_string[0] = ' ';
+		ts.printTo(ts_string + 1, sizeof(ts_string) - 1);
+	}
+	char value[16];
+	printFixed(value, sizeof(value), record->getTemp(), 3);
+	client.printf("# TYPE bme280_temperature_celsius gauge\nbme280_temperature_celsius{host=\"%u\"} %s%s\n", ESP.getChipId(), value, ts_string);
+	printFixed(value, sizeof(value), record->getPress(), 2);
+	client.printf("# TYPE bme280_pressure_pascals gauge\nbme280_pressure_pascals{host=\"%u\"} %s%s\n", ESP.getChipId(), value, ts_string);
+	printFixed(value, sizeof(value), record->getHum(), 4);
+	client.printf("# TYPE bme280_humidity_ratio gauge\nbme280_humidity_ratio{host=\"%u\"} %s%s\n", ESP.getChipId(), value, ts_string);
+}
+
+void MetricsServer::serveInflux(WiFiClient &client, uint32_t since) {
+	using rtcMem::gRTC;
+	// Same boot, so ahead of us can only be a client bug. Start over rather than skipping records.
+	if (since > gRTC.record_seq) {
+		since = 0;
+	}
+	uint32_t const first_seq = gRTC.record_seq - gRTC.stored_records + 1;
+
+	client.printf("HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nConnection: close\r\nX-Next-Cursor: %u-%u\r\n\r\n",
+				  gRTC.boot_id,
+				  gRTC.record_seq);
+	char line[160];
+	for (uint8_t i = 0; i < gRTC.stored_records; i++) {
+		auto record = rtcMem::record_at(i);
+		if (first_seq + i <= since || record == nullptr) {
+			continue;
+		}
+		int len = snprintf(line, sizeof(line), "bme280,host=%u ", ESP.getChipId());
+		len += record->printTo(line + len, sizeof(line) - len);
+		if (gRTC.anchor.is_set()) {
+			auto ts = gRTC.anchor;
+			ts.add(i * runtimeConfig::current().interval_ms);
+			line[len++] = ' ';
+			len += ts.printTo(line + len, sizeof(line) - len);
+			len += snprintf(line + len, sizeof(line) - len, "000000");
+		}
+		line[len++] = '\n';
+		client.write(reinterpret_cast<const uint8_t *>(line), len);
+	}
+}
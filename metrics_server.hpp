@@ -0,0 +1,27 @@
+#pragma once
+
+#include <ESP8266WiFi.h>
+
+#include "config.hpp"
+
+/*
+	Minimal HTTP endpoint for pull based collection in always connected (USE_OTA) builds:
+	 - GET /metrics                  current reading and wake budget overruns (wake_budget.hpp) in Prometheus exposition format
+	 - GET /influx?since=<cursor>    stored records newer than cursor in influx line protocol,
+	                                 X-Next-Cursor in the response is the cursor for the next request. Cursors are
+	                                 <boot_id>-<record_seq>, one from before the RTC header was lost returns everything.
+
+	Responses are written line by line from the record store into the socket, no payload is assembled in RAM.
+ */
+class MetricsServer {
+public:
+	MetricsServer();
+	void begin();
+	void handle();
+
+private:
+	void serveMetrics(WiFiClient &client);
+	void serveInflux(WiFiClient &client, uint32_t since);   // since: record_seq of the current boot
+
+	WiFiServer m_server;
+};
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "Arduino.h"
+
+#include "debug.hpp"
+
+/*
+	Slighly optimized variant of the usual timespec struct for our purposes:
+
+	Carry microseconds instead of ns + store thousand seconds instead of single
+
+	Fixed width members as this is also persisted in RTC memory.
+ */
+struct msec_timespec {
+	int32_t tv_millionsec; /* MillionSeconds */
+	int32_t tv_millisec;   /* Milliseconds */
+
+	void subtract(uint32_t millisec) {
+		if (millisec > 1e9) {
+			LOGE(LOG_MOD_MAIN, "Can only subtract below 1M seconds");
+		}
+		if (millisec > tv_millisec) {
+			tv_millionsec--;
+			tv_millisec += 1e9;
+		}
+		tv_millisec -= millisec;
+	};
+
+	void add(uint32_t millisec) {
+		if (millisec > 1e9) {
+			LOGE(LOG_MOD_MAIN, "Can only add below 1M seconds");
+		}
+		tv_millisec += millisec;
+		if (tv_millisec >= 1e9) {
+			tv_millionsec += 1;
+			tv_millisec -= 1e9;
+		}
+	}
+
+	auto is_set() const -> bool {
+		return tv_millionsec != 0;
+	}
+
+	// Milliseconds since epoch as decimal string, returns the snprintf result
+	auto printTo(char *buf, size_t len) const -> int {
+		return snprintf(buf, len, "%d%09d", tv_millionsec, tv_millisec);
+	}
+
+	String toString() const {
+		char ts_string[24];
+		printTo(ts_string, sizeof(ts_string));
+		return String(ts_string);
+	}
+};
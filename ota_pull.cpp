@@ -0,0 +1,210 @@
+#include "ota_pull.hpp"
+
+#include <ESP8266HTTPClient.h>
+#include <ESP8266WiFi.h>
+#include <Updater.h>
+
+#include <algorithm>
+
+#include "debug.hpp"
+#include "rtc_mem.hpp"
+#include "runtime_config.hpp"
+#include "wake_budget.hpp"
+
+namespace otaPull {
+namespace {
+const char* kNames[] = {"none", "gzip", "delta", "failed_fetch", "failed_write", "failed_verify"};
+
+static_assert(sizeof(kNames) / sizeof(kNames[0]) == static_cast<size_t>(otaResult::count), "Name missing for a result");
+
+#ifdef USE_PULL_OTA
+#define DELTA_MAGIC 0x544c4445   // "EDLT"
+#define DELTA_OP_COPY 'C'
+#define DELTA_OP_ADD 'A'
+
+// Shared by literal and flash reads, flashRead wants 4 byte aligned buffers
+uint32_t buffer[128];
+
+auto readExact(Stream& stream, void* data, size_t len) -> bool {
+	// readBytes gives up after the stream timeout, which is the remaining budget
+	return !wakeBudget::expired() && stream.readBytes(static_cast<uint8_t*>(data), len) == len;
+}
+
+auto write(const uint8_t* data, size_t len) -> bool {
+	if (Update.write(const_cast<uint8_t*>(data), len) != len) {
+		LOGE(LOG_MOD_NET, "Update write failed: %d", Update.getError());
+		return false;
+	}
+	return true;
+}
+
+// Literal bytes from the stream
+auto add(Stream& stream, uint32_t len) -> otaResult {
+	auto* const bytes = reinterpret_cast<uint8_t*>(buffer);
+	while (len > 0) {
+		uint32_t const n = std::min<uint32_t>(len, sizeof(buffer));
+		if (!readExact(stream, bytes, n)) {
+			return otaResult::failed_fetch;
+		}
+		if (!write(bytes, n)) {
+			return otaResult::failed_write;
+		}
+		len -= n;
+	}
+	return otaResult::none;
+}
+
+// Bytes of the running build, which starts at flash offset 0
+auto copy(uint32_t offset, uint32_t len) -> otaResult {
+	if (offset > ESP.getSketchSize() || len > ESP.getSketchSize() - offset) {
+		LOGE(LOG_MOD_NET, "Delta copies %u bytes from %u, beyond the running build", len, offset);
+		return otaResult::failed_write;
+	}
+	while (len > 0) {
+		uint32_t const skip = offset & 3;
+		uint32_t const n    = std::min<uint32_t>(len, sizeof(buffer) - skip);
+		if (!ESP.flashRead(offset - skip, buffer, (skip + n + 3) & ~3u) ||
+			!write(reinterpret_cast<uint8_t*>(buffer) + skip, n)) {
+			return otaResult::failed_write;
+		}
+		offset += n;
+		len -= n;
+	}
+	return otaResult::none;
+}
+
+auto applyDelta(Stream& stream, const String& md5) -> otaResult {
+	uint32_t header[2];
+	if (!readExact(stream, header, sizeof(header))) {
+		return otaResult::failed_fetch;
+	}
+	if (header[0] != DELTA_MAGIC || !Update.begin(header[1]) || !Update.setMD5(md5.c_str())) {
+		LOGE(LOG_MOD_NET, "Can't start delta update to %u bytes: %d", header[1], Update.getError());
+		return otaResult::failed_write;
+	}
+	uint32_t const size   = header[1];
+	uint32_t       filled = 0;
+	while (filled < size) {
+		uint8_t  op;
+		uint32_t len;
+		if (!readExact(stream, &op, sizeof(op)) || !readExact(stream, &len, sizeof(len))) {
+			return otaResult::failed_fetch;
+		}
+		if (len > size - filled) {
+			LOGE(LOG_MOD_NET, "Delta op exceeds the image");
+			return otaResult::failed_write;
+		}
+		auto result = otaResult::failed_write;
+		if (op == DELTA_OP_COPY) {
+			uint32_t offset;
+			result = readExact(stream, &offset, sizeof(offset)) ? copy(offset, len) : otaResult::failed_fetch;
+		} else if (op == DELTA_OP_ADD) {
+			result = add(stream, len);
+		}
+		if (result != otaResult::none) {
+			return result;
+		}
+		filled += len;
+	}
+	return otaResult::delta;
+}
+
+auto applyImage(Stream& stream, int size, const String& md5) -> otaResult {
+	if (size <= 0 || !Update.begin(size) || !Update.setMD5(md5.c_str())) {
+		LOGE(LOG_MOD_NET, "Can't start update with %d bytes: %d", size, Update.getError());
+		return otaResult::failed_write;
+	}
+	auto const result = add(stream, size);
+	return result == otaResult::none ? otaResult::gzip : result;
+}
+
+auto fetch() -> otaResult {
+	String url = OTA_URL;
+	url += "?id=";
+	url += ESP.getChipId();
+	url += "&md5=";
+	url += ESP.getSketchMD5();
+
+	WiFiClient client;
+	HTTPClient http;
+	if (!http.begin(client, url)) {
+		return otaResult::failed_fetch;
+	}
+	const char* headers[] = {"X-Image-Type", "X-Image-MD5"};
+	http.collectHeaders(headers, sizeof(headers) / sizeof(headers[0]));
+	client.setTimeout(wakeBudget::timeout());
+	http.setTimeout(wakeBudget::timeout());
+	int const httpCode = http.GET();
+	if (httpCode == HTTP_CODE_NOT_MODIFIED) {
+		LOGD(LOG_MOD_NET, "Running the current build");
+		http.end();
+		return otaResult::none;
+	}
+	if (httpCode != HTTP_CODE_OK) {
+		LOGW(LOG_MOD_NET, "[HTTP] GET OTA... code: %d", httpCode);
+		http.end();
+		return otaResult::failed_fetch;
+	}
+
+	String const type = http.header("X-Image-Type");
+	String const md5  = http.header("X-Image-MD5");
+	int const    size = http.getSize();
+	Stream&      body = http.getStream();
+	body.setTimeout(wakeBudget::timeout());
+	uint32_t const start = millis();
+
+	auto result = otaResult::failed_fetch;
+	if (type == "delta") {
+		result = applyDelta(body, md5);
+	} else if (type == "gzip") {
+		result = applyImage(body, size, md5);
+	} else {
+		LOGE(LOG_MOD_NET, "Unknown image type");
+	}
+	if (result == otaResult::gzip || result == otaResult::delta) {
+		// Checks the MD5 and the image header
+		if (!Update.end()) {
+			LOGE(LOG_MOD_NET, "Image rejected: %d", Update.getError());
+			result = otaResult::failed_verify;
+		} else {
+			LOGI(LOG_MOD_NET, "Installed %s image, %d bytes in %d ms", name(result), size, millis() - start);
+		}
+	} else if (Update.isRunning()) {
+		// Incomplete, so this only discards it
+		Update.end();
+	}
+	http.end();
+	return result;
+}
+#endif
+}   // namespace
+
+#ifdef USE_PULL_OTA
+void update() {
+	wakeBudget::begin(wakePhase::update);
+	auto const result = fetch();
+	wakeBudget::end();
+	if (result == otaResult::none) {
+		return;
+	}
+	rtcMem::gRTC.ota_result = result;
+	if (result == otaResult::gzip || result == otaResult::delta) {
+		// Stored records and the result survive the reset in RTC memory
+		rtcMem::write();
+		log_flush();
+#ifdef USE_DEEPSLEEP
+		// eboot installs the image on the wake-up reset, so a restart now would only cost an extra wake
+		uint32_t const interval = runtimeConfig::current().interval_ms;
+		uint32_t const now      = millis();
+		ESP.deepSleep(static_cast<uint64_t>(now < interval ? interval - now : 1) * 1000);
+#else
+		ESP.restart();
+#endif
+	}
+}
+#endif
+
+auto name(otaResult result) -> const char* {
+	return result < otaResult::count ? kNames[static_cast<uint8_t>(result)] : "unknown";
+}
+}   // namespace otaPull
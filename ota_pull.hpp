@@ -0,0 +1,36 @@
+#pragma once
+
+#include "Arduino.h"
+
+/*
+	Firmware updates pulled from OTA_URL on upload wakes (USE_PULL_OTA), so deep sleep nodes can be updated without
+	staying awake for ArduinoOTA:
+	 - the node asks for OTA_URL?id=<chip id>&md5=<MD5 of the running build>, 304 => up to date
+	 - the server answers with a gzip compressed image (eboot decompresses it when installing) or, if it has the running
+	   build, with a delta against it. X-Image-Type is "gzip" or "delta", X-Image-MD5 the MD5 of what ends up in the OTA
+	   partition (the .bin.gz itself resp. the rebuilt image), Updater refuses to install anything else.
+	 - delta format, little endian: "EDLT", uint32 image size, then ops until the image is complete:
+		'C' uint32 length, uint32 offset   copy from the running build in flash
+		'A' uint32 length, <bytes>         literal bytes
+	 - images are written to the OTA partition as they arrive. On success a USE_DEEPSLEEP node sleeps out the rest of
+	   its interval and boots into the new build on the wake-up reset, others restart right away.
+	   The result is kept in RTC memory and reported with the next upload, along with the build running then.
+	Images are only checked against the MD5 sent along, use the core's signed updates if the network isn't trusted.
+	Flashing via serial patches the flash size bytes of the image, the first update of such a node is always gzip.
+ */
+enum class otaResult : uint8_t {
+	none = 0,
+	gzip,            // installed a gzip image
+	delta,           // installed a delta
+	failed_fetch,    // server error, transfer aborted or out of time
+	failed_write,    // Updater refused the image or a delta op
+	failed_verify,   // MD5 or image header didn't match
+	count
+};
+
+namespace otaPull {
+// Asks OTA_URL for a newer build and installs it. Only returns if there is none or it failed, else sleeps/restarts.
+void update();
+
+auto name(otaResult result) -> const char*;
+}   // namespace otaPull
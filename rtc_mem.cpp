@@ -2,15 +2,47 @@
 
 #include "debug.hpp"
 #include "rtc_mem.hpp"
+#include "runtime_config.hpp"
 
 // Environment already has a crc32 linked in, no need for our own
 
 #define lcrc32(data, len) crc32(data, len, 0xffffffff)
 
+// rtcUserMemoryRead/Write take offsets in 4 byte blocks
+#define HEADER_OFFSET 0
+#define BLOCK_OFFSET(block) ((sizeof(rtcData) + (block) * sizeof(rtcRecordBlock)) / 4)
+#define TLS_OFFSET BLOCK_OFFSET(RECORD_BLOCKS)
+#define STORE_BYTES (sizeof(rtcData) + RECORD_BLOCKS * sizeof(rtcRecordBlock))
+
 // Could also be made a class, but since its currently basically a singleton namespace makes more sense
 namespace rtcMem {
-rtcData gRTC;
-bool    loadedValidMem = false;
+rtcData        gRTC;
+rtcRecordBlock gBlocks[RECORD_BLOCKS];
+uint32_t       loadedBlocks   = 0;   // Blocks mirrored in gBlocks
+uint32_t       dirtyBlocks    = 0;   // Blocks that need to be written back
+bool           loadedValidMem = false;
+
+// RTC transfers of this wake, logged by write() with what reading and writing the whole store would have taken
+uint32_t ioBytes = 0;
+uint32_t ioUs    = 0;
+
+static_assert(RECORD_BLOCKS <= 32, "Block bitmasks exceeded");
+
+static auto rtc_read(uint32_t offset, void* data, size_t size) -> bool {
+	uint32_t const start = micros();
+	bool const     res   = ESP.rtcUserMemoryRead(offset, static_cast<uint32_t*>(data), size);
+	ioUs += micros() - start;
+	ioBytes += size;
+	return res;
+}
+
+static auto rtc_write(uint32_t offset, void* data, size_t size) -> bool {
+	uint32_t const start = micros();
+	bool const     res   = ESP.rtcUserMemoryWrite(offset, static_cast<uint32_t*>(data), size);
+	ioUs += micros() - start;
+	ioBytes += size;
+	return res;
+}
 
 auto is_valid() -> bool {
 	return loadedValidMem;
@@ -18,32 +50,167 @@ auto is_valid() -> bool {
 
 auto read() -> bool {
 	LOGFUNC give_me_a_name("ReadRTC");
-	if (ESP.rtcUserMemoryRead(0, reinterpret_cast<uint32_t*>(&gRTC), sizeof(gRTC))) {
+	loadedBlocks = 0;
+	dirtyBlocks  = 0;
+	ioBytes      = 0;
+	ioUs         = 0;
+	if (rtc_read(HEADER_OFFSET, &gRTC, sizeof(gRTC))) {
 		// Calculate the CRC of what we just read from RTC memory, but skip the first 4 bytes as that's the checksum itself.
 		uint32_t crc = lcrc32(((uint8_t*)&gRTC) + 4, sizeof(gRTC) - 4);
 		if (crc == gRTC.crc32) {
-			if (MEM_VERSION == gRTC.version) {
-				LOGF("Data in RTC valid: %x\n", gRTC.crc32);
-				LOGF("Channel: %x\n", gRTC.channel);
-				LOGF("BSSID: %x:%x:%x:%x:%x:%x\n", gRTC.bssid[0], gRTC.bssid[1], gRTC.bssid[2], gRTC.bssid[3], gRTC.bssid[4], gRTC.bssid[5]);
+			// A build with a different STORED_RECORDS must not index past the store
+			if (MEM_VERSION == gRTC.version && gRTC.first_record < STORED_RECORDS && gRTC.stored_records <= STORED_RECORDS) {
+				LOGD(LOG_MOD_RTC, "Data in RTC valid: %x", gRTC.crc32);
+				for (const auto& ap : gRTC.ap_cache) {
+					if (ap.channel != 0) {
+						// BSSID as OUI + NIC half, an entry only takes LOG_MAX_ARGS arguments
+						LOGD(LOG_MOD_RTC,
+							 "AP: %06x%06x Channel: %d RSSI: %d (%d/%d)",
+							 (ap.bssid[0] << 16) | (ap.bssid[1] << 8) | ap.bssid[2],
+							 (ap.bssid[3] << 16) | (ap.bssid[4] << 8) | ap.bssid[5],
+							 ap.channel,
+							 ap.rssi,
+							 ap.successes,
+							 ap.failures);
+					}
+				}
 				loadedValidMem = true;
 				return true;
 			}
-			LOGF("CRC ok, but version failed: Want %x have %x\n", MEM_VERSION, gRTC.version);
+			LOGW(LOG_MOD_RTC, "CRC ok, but version or layout failed: Want %x have %x", MEM_VERSION, gRTC.version);
 
 		} else {
-			LOGLN("Data in RTC invalid");
+			LOGW(LOG_MOD_RTC, "Data in RTC invalid");
 		}
 	}
 	loadedValidMem = false;
 	memset(&gRTC, 0, sizeof(gRTC));
+	gRTC.boot_id = ESP.random();
+	// Nothing in the blocks is referenced anymore, no need to read them
+	memset(gBlocks, 0, sizeof(gBlocks));
+	loadedBlocks = (1ULL << RECORD_BLOCKS) - 1;
 	return false;
 };
 
+static auto block_crc(const rtcRecordBlock& block) -> uint32_t {
+	return lcrc32(((uint8_t*)&block) + 4, sizeof(block) - 4);
+}
+
+static void load_block(uint8_t block) {
+	if (loadedBlocks & (1UL << block)) {
+		return;
+	}
+	rtcRecordBlock& b = gBlocks[block];
+	if (!rtc_read(BLOCK_OFFSET(block), &b, sizeof(b)) || block_crc(b) != b.crc32) {
+		LOGW(LOG_MOD_RTC, "Record block %d invalid, dropping its records", block);
+		memset(&b, 0, sizeof(b));
+		// Written back with a valid CRC, so later wakes don't find it again
+		dirtyBlocks |= 1UL << block;
+	}
+	loadedBlocks |= 1UL << block;
+}
+
 auto write() -> bool {
 	LOGFUNC give_me_a_name("WriteRTC");
+	bool res = true;
+	for (uint8_t block = 0; block < RECORD_BLOCKS; block++) {
+		if (dirtyBlocks & (1UL << block)) {
+			gBlocks[block].crc32 = block_crc(gBlocks[block]);
+			res &= rtc_write(BLOCK_OFFSET(block), &gBlocks[block], sizeof(gBlocks[block]));
+		}
+	}
+	dirtyBlocks  = 0;
 	gRTC.version = MEM_VERSION;
 	gRTC.crc32   = lcrc32(((uint8_t*)&gRTC) + 4, sizeof(gRTC) - 4);
-	return ESP.rtcUserMemoryWrite(0, reinterpret_cast<uint32_t*>(&gRTC), sizeof(gRTC));
+	res &= rtc_write(HEADER_OFFSET, &gRTC, sizeof(gRTC));
+	// Same rate for the whole store read and written once
+	uint32_t const fullUs = ioBytes > 0 ? static_cast<uint64_t>(ioUs) * 2 * STORE_BYTES / ioBytes : 0;
+	LOGD(LOG_MOD_RTC, "RTC I/O %u bytes in %u us, saved %d us vs. %u bytes", ioBytes, ioUs, static_cast<int32_t>(fullUs - ioUs), static_cast<uint32_t>(2 * STORE_BYTES));
+	return res;
+};
+
+// Clears the valid bits of the oldest count slots, so they can't be mistaken for records later
+static void invalidate_slots(uint8_t count) {
+	for (uint8_t i = 0; i < count; i++) {
+		uint8_t const slot  = (gRTC.first_record + i) % STORED_RECORDS;
+		uint8_t const block = slot / RECORDS_PER_BLOCK;
+		load_block(block);
+		gBlocks[block].valid &= ~(1UL << (slot % RECORDS_PER_BLOCK));
+		dirtyBlocks |= 1UL << block;
+	}
+}
+
+static void advance_cursor(uint8_t count) {
+	if (count > gRTC.stored_records) {
+		count = gRTC.stored_records;
+	}
+	invalidate_slots(count);
+	gRTC.first_record = (gRTC.first_record + count) % STORED_RECORDS;
+	gRTC.stored_records -= count;
+	if (gRTC.stored_records == 0) {
+		// Resync with the timeserver once we start over, deep sleep timing drifts
+		gRTC.anchor = {0, 0};
+	} else if (gRTC.anchor.is_set()) {
+		gRTC.anchor.add(count * runtimeConfig::current().interval_ms);
+	}
+}
+
+void push_record(const sensor_data& record) {
+	if (gRTC.stored_records == STORED_RECORDS) {
+		LOGW(LOG_MOD_RTC, "Record store full, dropping oldest record");
+		advance_cursor(1);
+	}
+	uint8_t const slot  = (gRTC.first_record + gRTC.stored_records) % STORED_RECORDS;
+	uint8_t const block = slot / RECORDS_PER_BLOCK;
+	load_block(block);
+	gBlocks[block].records[slot % RECORDS_PER_BLOCK] = record;
+	gBlocks[block].valid |= 1UL << (slot % RECORDS_PER_BLOCK);
+	dirtyBlocks |= 1UL << block;
+	gRTC.stored_records++;
+	gRTC.record_seq++;
+};
+
+auto record_at(uint8_t index) -> const sensor_data* {
+	uint8_t const slot  = (gRTC.first_record + index) % STORED_RECORDS;
+	uint8_t const block = slot / RECORDS_PER_BLOCK;
+	load_block(block);
+	if (!(gBlocks[block].valid & (1UL << (slot % RECORDS_PER_BLOCK)))) {
+		return nullptr;
+	}
+	return &gBlocks[block].records[slot % RECORDS_PER_BLOCK];
+};
+
+void release_records(uint8_t count) {
+	advance_cursor(count);
+	gRTC.batch_seq++;
+};
+
+void clear_records() {
+	invalidate_slots(gRTC.stored_records);
+	gRTC.first_record   = 0;
+	gRTC.stored_records = 0;
+	gRTC.anchor         = {0, 0};
+};
+
+#ifdef USE_TLS
+static auto tls_crc(const rtcTlsBlock& block) -> uint32_t {
+	return lcrc32(((uint8_t*)&block) + 4, sizeof(block) - 4);
+}
+
+auto load_tls_session(uint8_t* session) -> bool {
+	rtcTlsBlock block;
+	if (!ESP.rtcUserMemoryRead(TLS_OFFSET, reinterpret_cast<uint32_t*>(&block), sizeof(block)) || tls_crc(block) != block.crc32) {
+		return false;
+	}
+	memcpy(session, block.session, sizeof(block.session));
+	return true;
+};
+
+auto store_tls_session(const uint8_t* session) -> bool {
+	rtcTlsBlock block;
+	memcpy(block.session, session, sizeof(block.session));
+	block.crc32 = tls_crc(block);
+	return ESP.rtcUserMemoryWrite(TLS_OFFSET, reinterpret_cast<uint32_t*>(&block), sizeof(block));
 };
-}   // namespace rtcMem
\ No newline at end of file
+#endif
+}   // namespace rtcMem
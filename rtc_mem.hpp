@@ -3,28 +3,87 @@
 
 #include "bme280_aggregator.hpp"
 #include "config.hpp"
+#include "msec_timespec.hpp"
+#include "ota_pull.hpp"
+#include "runtime_config.hpp"
+#include "wake_budget.hpp"
 
 namespace rtcMem {
-#define MEM_VERSION 3
+#define MEM_VERSION 13
+#define RECORDS_PER_BLOCK 5
+#define RECORD_BLOCKS (STORED_RECORDS / RECORDS_PER_BLOCK)
+
+static_assert(STORED_RECORDS % RECORDS_PER_BLOCK == 0, "STORED_RECORDS has to be a multiple of RECORDS_PER_BLOCK");
+
+/*
+	RTC user memory is split into blocks with their own CRC, so a wake only has to read the header
+	and write back the header + the record block it appended to:
+
+	| rtcData (header) | rtcRecordBlock 0 | rtcRecordBlock 1 | ... | rtcTlsBlock (USE_TLS only) |
+
+	Record blocks are loaded on first access. A block failing its CRC only invalidates the records stored in it and is
+	rewritten cleared with the next write(). Released slots lose their valid bit.
+	The TLS session is only read on upload wakes and survives an invalid header, see tls_session.hpp.
+ */
+typedef struct {
+	uint8_t bssid[6];
+	uint8_t channel;     // 0 => unused entry
+	int8_t  rssi;        // RSSI seen on the last successful connect or scan
+	uint8_t successes;   // Successful connects, saturating
+	uint8_t failures;    // Failed connects since the last success, saturating
+} apCacheEntry;
+
 typedef struct {
 	// Header
-	uint32_t crc32;
-	uint8_t  version;
-
-	// Wifi network information
-	uint8_t  channel;
-	uint8_t  bssid[6];
-	uint32_t ip_addr;
-	uint32_t gateway_addr;
-	uint32_t netmask;
-	uint32_t dns_addr;
-
-	// Stored records
-	uint8_t     stored_records;
-	sensor_data records[STORED_RECORDS];
+	uint32_t  crc32;
+	uint8_t   version;
+	uint8_t   budget_blown[static_cast<size_t>(wakePhase::count)];   // Wakes each phase ran out of time since the last report
+	otaResult ota_result;                                           // Last update attempt, reported with the next upload
+
+	// Wifi network information, known APs for SSID, see ESaveWifi
+	apCacheEntry ap_cache[WIFI_AP_CACHE];
+
+	// Stored records, ring buffer starting at first_record (= committed upload cursor)
+	uint8_t       first_record;
+	uint8_t       stored_records;
+	uint16_t      batch_seq;   // Sequence number of the next upload batch, only advances on acknowledged batches
+	uint16_t      boot_id;     // Random, drawn when the header is invalidated, tells a batch_seq that started over apart
+	uint32_t      record_seq;  // Records pushed since the header was last invalidated (power on, MEM_VERSION change, CRC failure), cursor for pull clients
+
+	runtime_config cfg;           // Config sent by the server, version 0 => use defaults
+	runtime_config pending_cfg;   // Received, but waiting for the stored records to be uploaded. Version 0 => none
+	msec_timespec anchor;      // Timestamp of the record at first_record, unset until fetched from TS_URL
+
+#ifdef USE_TLS
+	// First request of the last upload wake (handshake included), reported with the next upload. 0 => reported
+	uint16_t tls_request_ms;
+	bool     tls_resumed;
+	uint8_t  tls_reserved;
+#endif
 } rtcData;
 
-static_assert(sizeof(rtcData) < 512, "Size of RTC Memory exceeded");
+typedef struct {
+	uint32_t    crc32;
+	uint32_t    valid;   // Bitmask of slots holding a record written since the block was last lost
+	sensor_data records[RECORDS_PER_BLOCK];
+} rtcRecordBlock;
+
+#ifdef USE_TLS
+// BearSSL session parameters (session ID, version, cipher suite, master secret) are 86 bytes
+#define TLS_SESSION_BYTES 88
+
+typedef struct {
+	uint32_t crc32;
+	uint8_t  session[TLS_SESSION_BYTES];
+} rtcTlsBlock;
+
+#define RTC_TLS_BYTES sizeof(rtcTlsBlock)
+#else
+#define RTC_TLS_BYTES 0
+#endif
+
+static_assert(sizeof(rtcData) % 4 == 0 && sizeof(rtcRecordBlock) % 4 == 0, "RTC memory is accessed in 4 byte blocks");
+static_assert(sizeof(rtcData) + RECORD_BLOCKS * sizeof(rtcRecordBlock) + RTC_TLS_BYTES <= 512, "Size of RTC Memory exceeded");
 
 extern rtcData gRTC;
 
@@ -33,4 +92,23 @@ auto is_valid() -> bool;
 auto read() -> bool;
 
 auto write() -> bool;
+
+// Append a record, drops the oldest one if the store is full
+void push_record(const sensor_data& record);
+
+// Access stored records, 0 is the oldest one. Returns nullptr if the record was lost to a corrupted block.
+auto record_at(uint8_t index) -> const sensor_data*;
+
+// Release the oldest count records after they were acknowledged by the server
+void release_records(uint8_t count);
+
+void clear_records();
+
+#ifdef USE_TLS
+// Copies the cached TLS session to session (TLS_SESSION_BYTES), false if there is none
+auto load_tls_session(uint8_t* session) -> bool;
+
+// Caches session (TLS_SESSION_BYTES), written right away as it is independent of the header
+auto store_tls_session(const uint8_t* session) -> bool;
+#endif
 }   // namespace rtcMem
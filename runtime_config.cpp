@@ -0,0 +1,81 @@
+#include "runtime_config.hpp"
+
+#include "debug.hpp"
+#include "rtc_mem.hpp"
+#include "sensor_tuner.hpp"
+
+namespace runtimeConfig {
+namespace {
+const runtime_config kDefaults = {
+	.interval_ms     = INTERVAL_MS,
+	.version         = 0,
+	.chunk_bytes     = UPLOAD_CHUNK_BYTES,
+	.wifi_attempt_ms = WIFI_ATTEMPT_MS,
+	.record_limit    = RECORD_LIMIT,
+	.osrs_t          = BME_OSRS_T,
+	.osrs_p          = BME_OSRS_P,
+	.osrs_h          = BME_OSRS_H,
+	.filter          = BME_FILTER,
+	.reserved        = 0,
+};
+
+// Snapshot taken on first use, so a config received during a wake only takes effect on the next one
+runtime_config active;
+bool           loaded = false;
+}   // namespace
+
+auto current() -> const runtime_config& {
+	if (!loaded) {
+		if (rtcMem::gRTC.cfg.version != 0) {
+			active = rtcMem::gRTC.cfg;
+		} else {
+			active = kDefaults;
+			sensorTuner::load(active);
+		}
+		loaded = true;
+	}
+	return active;
+};
+
+auto parse(const String& line, runtime_config& out) -> bool {
+	unsigned version, interval, limit, osrs_t, osrs_p, osrs_h, filter, chunk, attempt;
+	if (sscanf(line.c_str(),
+			   "cfg v=%u interval=%u limit=%u osrs=%u,%u,%u filter=%u chunk=%u attempt=%u",
+			   &version,
+			   &interval,
+			   &limit,
+			   &osrs_t,
+			   &osrs_p,
+			   &osrs_h,
+			   &filter,
+			   &chunk,
+			   &attempt) != 9) {
+		LOGW(LOG_MOD_CFG, "Malformed config line");
+		return false;
+	}
+	// Anything out of range would brick the node until the next power cycle, reject the whole config instead
+	if (version == 0 || version > UINT16_MAX || interval < 1000 || interval > 3600000 || limit >= STORED_RECORDS || osrs_t > 5 ||
+		osrs_p > 5 || osrs_h > 5 || filter > 4 || chunk < 128 || chunk > 4096 || attempt < 100 || attempt > 10000) {
+		LOGW(LOG_MOD_CFG, "Config %u out of range, ignored", version);
+		return false;
+	}
+	out = {
+		.interval_ms     = interval,
+		.version         = static_cast<uint16_t>(version),
+		.chunk_bytes     = static_cast<uint16_t>(chunk),
+		.wifi_attempt_ms = static_cast<uint16_t>(attempt),
+		.record_limit    = static_cast<uint8_t>(limit),
+		.osrs_t          = static_cast<uint8_t>(osrs_t),
+		.osrs_p          = static_cast<uint8_t>(osrs_p),
+		.osrs_h          = static_cast<uint8_t>(osrs_h),
+		.filter          = static_cast<uint8_t>(filter),
+		.reserved        = 0,
+	};
+	return true;
+};
+
+void apply(const runtime_config& cfg) {
+	LOGI(LOG_MOD_CFG, "Applying config version %d from next wake on", cfg.version);
+	rtcMem::gRTC.cfg = cfg;
+};
+}   // namespace runtimeConfig
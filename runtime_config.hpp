@@ -0,0 +1,40 @@
+#pragma once
+
+#include "Arduino.h"
+
+#include "config.hpp"
+
+/*
+	Settings the server can change at runtime, persisted in RTC memory (gRTC.cfg). A received config waits in
+	gRTC.pending_cfg until the records stored with the current interval are uploaded.
+
+	The timeserver appends a config line to its response if the version we report differs from its own:
+		cfg v=<version> interval=<ms> limit=<records> osrs=<t>,<p>,<h> filter=<f> chunk=<bytes> attempt=<ms>
+	osrs/filter are the raw BME280 register codes. Version 0 means compile time defaults from config.hpp, with the
+	BME settings taken from the profile stored by sensor_tuner.hpp if there is one.
+ */
+typedef struct {
+	uint32_t interval_ms;       // INTERVAL_MS
+	uint16_t version;           // 0 => defaults
+	uint16_t chunk_bytes;       // UPLOAD_CHUNK_BYTES
+	uint16_t wifi_attempt_ms;   // WIFI_ATTEMPT_MS
+	uint8_t  record_limit;      // RECORD_LIMIT
+	uint8_t  osrs_t;
+	uint8_t  osrs_p;
+	uint8_t  osrs_h;
+	uint8_t  filter;
+	uint8_t  reserved;
+} runtime_config;
+
+static_assert(sizeof(runtime_config) == 16, "Unexpected runtime_config padding");
+
+namespace runtimeConfig {
+// Active configuration, the defaults unless the server sent one
+auto current() -> const runtime_config&;
+
+// Parses and validates a config line as described above
+auto parse(const String& line, runtime_config& out) -> bool;
+
+// Takes over a parsed config, it is used from the next wake on
+void apply(const runtime_config& cfg);
+}   // namespace runtimeConfig
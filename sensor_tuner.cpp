@@ -0,0 +1,220 @@
+#include "sensor_tuner.hpp"
+
+#include <EEPROM.h>
+#include <coredecls.h>
+
+#include <algorithm>
+#include <cmath>
+
+#include "debug.hpp"
+#ifdef USE_SIM_SENSOR
+#include "bme280_sim.hpp"
+#endif
+
+// Nothing else uses the EEPROM emulation, the profile sits at its start
+#define TUNED_PROFILE_OFFSET 0
+#define TUNED_PROFILE_VERSION 1
+
+namespace sensorTuner {
+namespace {
+typedef struct {
+	uint32_t crc32;
+	uint8_t  version;
+	uint8_t  osrs_t;
+	uint8_t  osrs_p;
+	uint8_t  osrs_h;
+	uint8_t  filter;
+	uint8_t  reserved[3];
+} storedProfile;
+
+enum { CH_T, CH_P, CH_H, CHANNELS };
+
+// Units of sensor_data::getTemp/getPress/getHum
+const uint32_t kTargets[CHANNELS] = {TUNE_NOISE_T, TUNE_NOISE_P, TUNE_NOISE_H};
+
+// Register codes SAMPLING_X1..X16 and FILTER_OFF..X16
+#define TUNE_OSRS 5
+#define TUNE_FILTERS 5
+
+typedef struct {
+	uint32_t noise[CHANNELS];
+	uint32_t conversion_us;   // measured, 0 if the forced conversion timed out
+} profileResult;
+
+auto profileCrc(const storedProfile& profile) -> uint32_t {
+	return crc32(reinterpret_cast<const uint8_t*>(&profile) + 4, sizeof(profile) - 4, 0xffffffff);
+}
+
+auto factor(uint8_t code) -> uint8_t {
+	return code == 0 ? 0 : 1 << (std::min<uint8_t>(code, 5) - 1);
+}
+
+auto meets(const profileResult& result) -> bool {
+	for (uint8_t ch = 0; ch < CHANNELS; ch++) {
+		if (result.noise[ch] > kTargets[ch]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+template <typename Sampling>
+void printRow(char mark, const Sampling& sampling, const profileResult& result) {
+	// Filter codes 1..4 are coefficients 2..16
+	char filter[4] = "off";
+	if (sampling.filter != 0) {
+		snprintf(filter, sizeof(filter), "x%u", factor(sampling.filter + 1));
+	}
+	Serial.printf("%c x%-2u x%-2u x%-2u   %-3s %8u %8u %6u %6u %6u %6u\n",
+				  mark,
+				  factor(sampling.osrs_t),
+				  factor(sampling.osrs_p),
+				  factor(sampling.osrs_h),
+				  filter,
+				  result.conversion_us,
+				  sampling.conversionUs(),
+				  sampling.settleMs(),
+				  result.noise[CH_T],
+				  result.noise[CH_P],
+				  result.noise[CH_H]);
+}
+
+template <typename Bus>
+auto measure(BME280Aggregator<Bus>&                                 bme,
+			 const Bus&                                             bus,
+			 const typename BME280Aggregator<Bus>::sampling_config& sampling,
+			 profileResult&                                         result) -> bool {
+	uint64_t squares[CHANNELS] = {};
+	int32_t  last[CHANNELS]    = {};
+	for (uint16_t i = 0; i < TUNE_SAMPLES; i++) {
+		// Same sequence as a wake, so the IIR filter starts over with each reading
+		if (!bme.begin(bus, sampling)) {
+			return false;
+		}
+		auto const    data             = bme.readAllSensors();
+		int32_t const values[CHANNELS] = {data.getTemp(), data.getPress(), data.getHum()};
+		for (uint8_t ch = 0; ch < CHANNELS; ch++) {
+			if (i > 0) {
+				int64_t const diff = values[ch] - last[ch];
+				squares[ch] += diff * diff;
+			}
+			last[ch] = values[ch];
+		}
+	}
+	for (uint8_t ch = 0; ch < CHANNELS; ch++) {
+		result.noise[ch] = lround(sqrt(squares[ch] / (2.0 * (TUNE_SAMPLES - 1))));
+	}
+	result.conversion_us = bme.timeForcedConversion();
+	return true;
+}
+
+// False if the stored profile is the same already, a flash sector erase is only spent on a change
+template <typename Sampling>
+auto store(const Sampling& sampling) -> bool {
+	storedProfile profile = {0, TUNED_PROFILE_VERSION, sampling.osrs_t, sampling.osrs_p, sampling.osrs_h, sampling.filter, {0, 0, 0}};
+	profile.crc32         = profileCrc(profile);
+	storedProfile stored;
+	EEPROM.begin(TUNED_PROFILE_OFFSET + sizeof(profile));
+	EEPROM.get(TUNED_PROFILE_OFFSET, stored);
+	bool const changed = memcmp(&stored, &profile, sizeof(profile)) != 0;
+	if (changed) {
+		EEPROM.put(TUNED_PROFILE_OFFSET, profile);
+		EEPROM.commit();
+	}
+	EEPROM.end();
+	return changed;
+}
+}   // namespace
+
+template <typename Bus>
+auto run(BME280Aggregator<Bus>& bme, const Bus& bus) -> bool {
+	using sampling_config = typename BME280Aggregator<Bus>::sampling_config;
+	static_assert(TUNE_SAMPLES >= 2, "Noise needs at least two samples");
+	static_assert(TUNE_SETTLE_MAX_MS > 0 && TUNE_SETTLE_MAX_MS < BUDGET_SENSOR_MS, "BUDGET_SENSOR_MS too short for any profile");
+
+	// Not only for DEBUG builds
+	Serial.begin(DEBUG_BAUDRATE);
+	Serial.printf("Sensor tuning, %u samples per profile, targets %u mC / %u cPa / %u c%%RH\n",
+				  TUNE_SAMPLES,
+				  kTargets[CH_T],
+				  kTargets[CH_P],
+				  kTargets[CH_H]);
+	Serial.println("  osrs t/p/h  filter  conv us   max us settle  T[mC] P[cPa] H[c%RH]");
+
+	profileResult sweep[TUNE_FILTERS][TUNE_OSRS];
+	for (uint8_t filter = 0; filter < TUNE_FILTERS; filter++) {
+		for (uint8_t osrs = 0; osrs < TUNE_OSRS; osrs++) {
+			uint8_t const         code     = osrs + 1;
+			sampling_config const sampling = {code, code, code, filter};
+			if (!measure(bme, bus, sampling, sweep[filter][osrs])) {
+				Serial.println("Sensor failed, tuning aborted");
+				return false;
+			}
+			printRow(' ', sampling, sweep[filter][osrs]);
+		}
+	}
+
+	// Per filter setting the lowest oversampling of each channel that met its target (x16 if none did)
+	sampling_config candidates[TUNE_FILTERS];
+	for (uint8_t filter = 0; filter < TUNE_FILTERS; filter++) {
+		uint8_t codes[CHANNELS];
+		for (uint8_t ch = 0; ch < CHANNELS; ch++) {
+			uint8_t osrs = 0;
+			while (osrs < TUNE_OSRS - 1 && sweep[filter][osrs].noise[ch] > kTargets[ch]) {
+				osrs++;
+			}
+			codes[ch] = osrs + 1;
+		}
+		candidates[filter] = {codes[CH_T], codes[CH_P], codes[CH_H], filter};
+	}
+	std::sort(candidates, candidates + TUNE_FILTERS, [](const sampling_config& a, const sampling_config& b) {
+		return a.settleMs() < b.settleMs();
+	});
+
+	// Channels influence each other a bit (t_fine, self heating), so confirm the mixed profiles
+	Serial.println("Candidates, cheapest first:");
+	for (auto const& candidate : candidates) {
+		if (candidate.settleMs() > TUNE_SETTLE_MAX_MS) {
+			// Sorted, so the rest takes even longer
+			Serial.printf("Next one settles in %u ms, more than the %u ms the sensor phase allows\n", candidate.settleMs(), TUNE_SETTLE_MAX_MS);
+			break;
+		}
+		profileResult result;
+		if (!measure(bme, bus, candidate, result)) {
+			Serial.println("Sensor failed, tuning aborted");
+			return false;
+		}
+		printRow('*', candidate, result);
+		if (meets(result)) {
+			Serial.printf("%s, wakes wait %u ms for the sensor\n", store(candidate) ? "Stored" : "Same as stored", candidate.settleMs());
+			return true;
+		}
+	}
+	Serial.println("No profile meets the targets, stored profile left as is");
+	return false;
+}
+
+auto load(runtime_config& cfg) -> bool {
+	storedProfile profile;
+	EEPROM.begin(TUNED_PROFILE_OFFSET + sizeof(profile));
+	EEPROM.get(TUNED_PROFILE_OFFSET, profile);
+	EEPROM.end();
+	// Erased flash fails the version check already
+	if (profile.version != TUNED_PROFILE_VERSION || profile.crc32 != profileCrc(profile)) {
+		return false;
+	}
+	cfg.osrs_t = profile.osrs_t;
+	cfg.osrs_p = profile.osrs_p;
+	cfg.osrs_h = profile.osrs_h;
+	cfg.filter = profile.filter;
+	LOGD(LOG_MOD_SENSOR, "Tuned profile: osrs %d/%d/%d filter %d", cfg.osrs_t, cfg.osrs_p, cfg.osrs_h, cfg.filter);
+	return true;
+}
+
+// Same bus policies as BME280Aggregator
+template auto run(BME280Aggregator<BME280I2CBus>& bme, const BME280I2CBus& bus) -> bool;
+template auto run(BME280Aggregator<BME280SPIBus>& bme, const BME280SPIBus& bus) -> bool;
+#ifdef USE_SIM_SENSOR
+template auto run(BME280Aggregator<BME280I2CBusT<BME280Sim>>& bme, const BME280I2CBusT<BME280Sim>& bus) -> bool;
+#endif
+}   // namespace sensorTuner
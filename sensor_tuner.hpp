@@ -0,0 +1,33 @@
+#pragma once
+
+#include "Arduino.h"
+
+#include "bme280_aggregator.hpp"
+#include "config.hpp"
+#include "runtime_config.hpp"
+
+/*
+	Picks the BME280 oversampling/filter profile for the node (USE_SENSOR_TUNING in config.hpp).
+
+	Calibration: each uniform profile (same oversampling for all channels, x1..x16, filter off..x16) is read
+	TUNE_SAMPLES times exactly like a wake does it (soft reset, settle, read). Noise is the standard deviation of
+	consecutive readings (differences / sqrt 2, so slow changes of the environment don't count), conversion time is
+	measured in forced mode. For each filter setting the lowest oversampling per channel meeting the TUNE_NOISE_*
+	target is combined into a candidate, candidates are measured again from the cheapest (shortest settle time,
+	see BME280Aggregator::sampling_config::settleMs) on and the first one meeting all targets is stored in flash.
+	Candidates settling longer than TUNE_SETTLE_MAX_MS are skipped, every wake would run out of its sensor budget.
+	Runs after power on and reset pin only (wlan_sketch.ino), flash is only written if the profile changed.
+
+	The stored profile replaces BME_OSRS_* / BME_FILTER as defaults, a config pushed by the server still wins.
+ */
+// Settle wait a stored profile may take, the rest of BUDGET_SENSOR_MS goes to soft reset, NVM copy and reading
+#define TUNE_SETTLE_MAX_MS (BUDGET_SENSOR_MS - 30)
+
+namespace sensorTuner {
+// Runs the calibration, prints the noise vs. conversion time table to Serial. Takes a few minutes.
+template <typename Bus>
+auto run(BME280Aggregator<Bus>& bme, const Bus& bus) -> bool;
+
+// Overrides the BME settings of cfg with the stored profile, false if there is none
+auto load(runtime_config& cfg) -> bool;
+}   // namespace sensorTuner
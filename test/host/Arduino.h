@@ -0,0 +1,157 @@
+#pragma once
+
+#include <cmath>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+/*
+	Just enough of the ESP8266 Arduino core to run the sensor path and the RTC store on the host, see test/Makefile.
+
+	Time is fake: delay() advances the clock, every micros()/millis() call takes 1 us so polling loops terminate.
+	Bus wire time of the simulator is not added to it.
+ */
+typedef uint8_t byte;
+
+#define PSTR(s) (s)
+#define HIGH 1
+#define LOW 0
+#define OUTPUT 1
+#define SS 15
+
+namespace hostClock {
+extern uint32_t us;
+}
+
+inline auto micros() -> uint32_t {
+	return ++hostClock::us;
+}
+inline auto millis() -> uint32_t {
+	return micros() / 1000;
+}
+inline void delay(uint32_t ms) {
+	hostClock::us += ms * 1000;
+}
+inline void yield() {
+}
+inline void pinMode(uint8_t, uint8_t) {
+}
+inline void digitalWrite(uint8_t, uint8_t) {
+}
+
+class String {
+public:
+	String(const char* s = "") : m_s(s) {
+	}
+	auto c_str() const -> const char* {
+		return m_s.c_str();
+	}
+	auto length() const -> size_t {
+		return m_s.length();
+	}
+	auto operator+=(const char* s) -> String& {
+		m_s += s;
+		return *this;
+	}
+	auto operator==(const char* s) const -> bool {
+		return m_s == s;
+	}
+
+private:
+	std::string m_s;
+};
+
+// Prints to stdout and keeps everything printed in output, so tests can look at it
+class HardwareSerial {
+public:
+	void begin(unsigned long) {
+	}
+	void setTimeout(unsigned long) {
+	}
+	explicit operator bool() const {
+		return true;
+	}
+	auto print(const char* s) -> size_t {
+		return emit("%s", s);
+	}
+	auto print(const String& s) -> size_t {
+		return emit("%s", s.c_str());
+	}
+	auto print(long v, int base = 10) -> size_t {
+		return base == 16 ? emit("%lx", v) : emit("%ld", v);
+	}
+	auto print(int v, int base = 10) -> size_t {
+		return print(static_cast<long>(v), base);
+	}
+	auto print(unsigned v, int base = 10) -> size_t {
+		return print(static_cast<long>(v), base);
+	}
+	auto print(unsigned long v, int base = 10) -> size_t {
+		return print(static_cast<long>(v), base);
+	}
+	auto println() -> size_t {
+		return emit("\n");
+	}
+	template <typename T>
+	auto println(T v) -> size_t {
+		return print(v) + println();
+	}
+	template <typename T>
+	auto println(T v, int base) -> size_t {
+		return print(v, base) + println();
+	}
+	auto printf(const char* fmt, ...) -> size_t __attribute__((format(printf, 2, 3)));
+	auto printf_P(const char* fmt, ...) -> size_t;
+	void flush() {
+		fflush(stdout);
+	}
+
+	std::string output;
+
+private:
+	auto emit(const char* fmt, ...) -> size_t __attribute__((format(printf, 2, 3)));
+	auto vemit(const char* fmt, va_list args) -> size_t;
+};
+
+extern HardwareSerial Serial;
+
+class EspClass {
+public:
+	auto getCycleCount() -> uint32_t {
+		return hostClock::us * 80;
+	}
+	auto getChipId() -> uint32_t {
+		return 0x123456;
+	}
+	auto random() -> uint32_t {
+		return static_cast<uint32_t>(::rand());
+	}
+	// Offsets in 4 byte blocks like the core, sizes in bytes
+	auto rtcUserMemoryRead(uint32_t offset, uint32_t* data, size_t size) -> bool {
+		if (offset * 4 + size > sizeof(rtcMemory)) {
+			return false;
+		}
+		memcpy(data, rtcMemory + offset * 4, size);
+		rtcBytesRead += size;
+		return true;
+	}
+	auto rtcUserMemoryWrite(uint32_t offset, uint32_t* data, size_t size) -> bool {
+		if (offset * 4 + size > sizeof(rtcMemory)) {
+			return false;
+		}
+		memcpy(rtcMemory + offset * 4, data, size);
+		rtcBytesWritten += size;
+		return true;
+	}
+
+	// RTC user memory survives "deep sleep" between tests, which count the bytes moved per wake
+	uint8_t  rtcMemory[512] = {};
+	uint32_t rtcBytesRead    = 0;
+	uint32_t rtcBytesWritten = 0;
+};
+
+extern EspClass ESP;
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "Arduino.h"
+
+// RAM backed, starts out erased. commits counts flash writes.
+class EEPROMClass {
+public:
+	void begin(size_t size) {
+		m_size = size;
+	}
+	template <typename T>
+	auto get(int address, T& value) -> T& {
+		memcpy(&value, m_data + address, sizeof(T));
+		return value;
+	}
+	template <typename T>
+	auto put(int address, const T& value) -> const T& {
+		memcpy(m_data + address, &value, sizeof(T));
+		return value;
+	}
+	auto commit() -> bool {
+		commits++;
+		return m_size > 0;
+	}
+	auto end() -> bool {
+		m_size = 0;
+		return true;
+	}
+	void erase() {
+		memset(m_data, 0xFF, sizeof(m_data));
+	}
+
+	uint32_t commits = 0;
+
+private:
+	uint8_t m_data[4096] = {};
+	size_t  m_size       = 0;
+};
+
+extern EEPROMClass EEPROM;
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "Arduino.h"
+
+#define MSBFIRST 1
+#define SPI_MODE0 0
+
+class SPISettings {
+public:
+	SPISettings(uint32_t, uint8_t, uint8_t) {
+	}
+};
+
+// No device on the bus, reads return 0xFF
+class SPIClass {
+public:
+	void begin() {
+	}
+	void beginTransaction(const SPISettings&) {
+	}
+	void endTransaction() {
+	}
+	auto transfer(uint8_t) -> uint8_t {
+		return 0xFF;
+	}
+};
+
+extern SPIClass SPI;
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "Arduino.h"
+
+// No device on the bus, tests plug BME280Sim into BME280I2CBusT instead
+class TwoWire {
+public:
+	void begin() {
+	}
+	void setClock(uint32_t) {
+	}
+	void beginTransmission(uint8_t) {
+	}
+	auto write(uint8_t) -> size_t {
+		return 1;
+	}
+	auto endTransmission(bool = true) -> uint8_t {
+		return 2;
+	}
+	auto requestFrom(uint8_t, uint8_t) -> uint8_t {
+		return 0;
+	}
+	auto available() -> int {
+		return 0;
+	}
+	auto read() -> int {
+		return -1;
+	}
+};
+
+extern TwoWire Wire;
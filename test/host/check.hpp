@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdio>
+
+// Minimal assertions, a test binary returns the number of failed checks
+inline int checkFailures = 0;
+
+#define CHECK(cond)                                                         \
+	do {                                                                    \
+		if (!(cond)) {                                                      \
+			printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+			checkFailures++;                                                \
+		}                                                                   \
+	} while (0)
+
+#define CHECK_EQ(a, b)                                                                                                   \
+	do {                                                                                                                 \
+		auto const checkA = (a);                                                                                         \
+		auto const checkB = (b);                                                                                         \
+		if (!(checkA == checkB)) {                                                                                       \
+			printf("%s:%d: %s == %s failed: %lld vs %lld\n", __FILE__, __LINE__, #a, #b, (long long)checkA, (long long)checkB); \
+			checkFailures++;                                                                                             \
+		}                                                                                                                \
+	} while (0)
+
+#define CHECK_NEAR(a, b, tolerance)                                                                                   \
+	do {                                                                                                              \
+		double const checkA = (a);                                                                                    \
+		double const checkB = (b);                                                                                    \
+		if (checkA < checkB - (tolerance) || checkA > checkB + (tolerance)) {                                         \
+			printf("%s:%d: %s ~ %s failed: %g vs %g\n", __FILE__, __LINE__, #a, #b, checkA, checkB);                 \
+			checkFailures++;                                                                                          \
+		}                                                                                                             \
+	} while (0)
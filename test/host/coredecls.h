@@ -0,0 +1,6 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+auto crc32(const void* data, size_t length, uint32_t crc = 0xffffffff) -> uint32_t;
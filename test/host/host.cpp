@@ -0,0 +1,59 @@
+#include "Arduino.h"
+#include "EEPROM.h"
+#include "SPI.h"
+#include "Wire.h"
+#include "coredecls.h"
+
+namespace hostClock {
+uint32_t us = 0;
+}
+
+HardwareSerial Serial;
+EspClass       ESP;
+TwoWire        Wire;
+SPIClass       SPI;
+EEPROMClass    EEPROM;
+
+auto HardwareSerial::vemit(const char* fmt, va_list args) -> size_t {
+	char buf[512];
+	int  len = vsnprintf(buf, sizeof(buf), fmt, args);
+	fputs(buf, stdout);
+	output += buf;
+	return len;
+}
+
+auto HardwareSerial::emit(const char* fmt, ...) -> size_t {
+	va_list args;
+	va_start(args, fmt);
+	auto const len = vemit(fmt, args);
+	va_end(args);
+	return len;
+}
+
+auto HardwareSerial::printf(const char* fmt, ...) -> size_t {
+	va_list args;
+	va_start(args, fmt);
+	auto const len = vemit(fmt, args);
+	va_end(args);
+	return len;
+}
+
+auto HardwareSerial::printf_P(const char* fmt, ...) -> size_t {
+	va_list args;
+	va_start(args, fmt);
+	auto const len = vemit(fmt, args);
+	va_end(args);
+	return len;
+}
+
+// Same polynomial as the core's (MSB first 0x04c11db7), the value only has to be stable within a test
+auto crc32(const void* data, size_t length, uint32_t crc) -> uint32_t {
+	auto const* bytes = static_cast<const uint8_t*>(data);
+	while (length--) {
+		crc ^= static_cast<uint32_t>(*bytes++) << 24;
+		for (int i = 0; i < 8; i++) {
+			crc = crc & 0x80000000 ? (crc << 1) ^ 0x04c11db7 : crc << 1;
+		}
+	}
+	return crc;
+}
@@ -0,0 +1,228 @@
+#include "host/check.hpp"
+#include "rtc_mem.hpp"
+
+/*
+	RTC record store against a RAM backed ESP.rtcUserMemoryRead/Write. Each rtcMem::read() starts a new wake,
+	ESP.rtcMemory keeps its content like RTC memory does across deep sleep.
+ */
+using rtcMem::gRTC;
+
+namespace {
+#define BLOCK_BYTES sizeof(rtcMem::rtcRecordBlock)
+#define BLOCK_START(block) (sizeof(rtcMem::rtcData) + (block) * BLOCK_BYTES)
+
+auto record(int32_t n) -> sensor_data {
+	return {n, n * 10, n * 100};
+}
+
+// Bytes moved by one wake, from read() to write()
+struct wakeIo {
+	uint32_t read;
+	uint32_t written;
+};
+
+auto startWake(bool& valid) -> uint32_t {
+	ESP.rtcBytesRead    = 0;
+	ESP.rtcBytesWritten = 0;
+	valid               = rtcMem::read();
+	return ESP.rtcBytesRead;
+}
+
+auto endWake() -> wakeIo {
+	CHECK(rtcMem::write());
+	return {ESP.rtcBytesRead, ESP.rtcBytesWritten};
+}
+
+// Oldest first, -1 for a lost record
+void checkRecords(std::initializer_list<int32_t> expected) {
+	CHECK_EQ(gRTC.stored_records, expected.size());
+	uint8_t index = 0;
+	for (int32_t n : expected) {
+		auto const* r = rtcMem::record_at(index++);
+		if (n < 0) {
+			CHECK(r == nullptr);
+		} else {
+			CHECK(r != nullptr && r->temperature == n);
+		}
+	}
+}
+
+void testFreshStore() {
+	memset(ESP.rtcMemory, 0xA5, sizeof(ESP.rtcMemory));
+	bool valid;
+	// Invalid header: the blocks aren't even read
+	CHECK_EQ(startWake(valid), sizeof(rtcMem::rtcData));
+	CHECK(!valid);
+	CHECK_EQ(gRTC.stored_records, 0);
+	CHECK_EQ(gRTC.record_seq, 0u);
+	rtcMem::push_record(record(1));
+	auto const io = endWake();
+	CHECK_EQ(io.read, sizeof(rtcMem::rtcData));
+	CHECK_EQ(io.written, sizeof(rtcMem::rtcData) + BLOCK_BYTES);
+
+	uint16_t const boot = gRTC.boot_id;
+	CHECK_EQ(startWake(valid), sizeof(rtcMem::rtcData));
+	CHECK(valid);
+	CHECK_EQ(gRTC.boot_id, boot);
+	checkRecords({1});
+}
+
+void testWakeIo() {
+	memset(ESP.rtcMemory, 0, sizeof(ESP.rtcMemory));
+	bool valid;
+	startWake(valid);
+	endWake();
+
+	// A sensor wake reads the header and the block it appends to, writes both back.
+	// The 6th record starts block 1, block 0 isn't touched anymore.
+	wakeIo io = {};
+	for (int32_t n = 0; n < 7; n++) {
+		startWake(valid);
+		CHECK(valid);
+		rtcMem::push_record(record(n));
+		io = endWake();
+		CHECK_EQ(io.read, sizeof(rtcMem::rtcData) + BLOCK_BYTES);
+		CHECK_EQ(io.written, sizeof(rtcMem::rtcData) + BLOCK_BYTES);
+	}
+	CHECK_EQ(gRTC.stored_records, 7);
+	printf("sensor wake: %u bytes read, %u written, whole store read + written: %u\n",
+		   io.read,
+		   io.written,
+		   static_cast<uint32_t>(2 * (sizeof(rtcMem::rtcData) + RECORD_BLOCKS * BLOCK_BYTES)));
+
+	// An upload wake reads every block with records, writes back the ones whose slots it released
+	startWake(valid);
+	for (uint8_t i = 0; i < gRTC.stored_records; i++) {
+		CHECK(rtcMem::record_at(i) != nullptr);
+	}
+	rtcMem::release_records(gRTC.stored_records);
+	io = endWake();
+	CHECK_EQ(io.read, sizeof(rtcMem::rtcData) + 2 * BLOCK_BYTES);
+	CHECK_EQ(io.written, sizeof(rtcMem::rtcData) + 2 * BLOCK_BYTES);
+	printf("upload wake of 7 records: %u bytes read, %u written\n", io.read, io.written);
+}
+
+void testCorruptedBlock() {
+	memset(ESP.rtcMemory, 0, sizeof(ESP.rtcMemory));
+	bool valid;
+	startWake(valid);
+	for (int32_t n = 0; n < 2 * RECORDS_PER_BLOCK + 1; n++) {
+		rtcMem::push_record(record(n));
+	}
+	endWake();
+
+	// One flipped bit in block 1 loses its records only
+	ESP.rtcMemory[BLOCK_START(1) + 12] ^= 0x10;
+	startWake(valid);
+	CHECK(valid);
+	checkRecords({0, 1, 2, 3, 4, -1, -1, -1, -1, -1, 10});
+	// Rewritten zeroed with a valid CRC, even though nothing else changed in it
+	auto const io = endWake();
+	CHECK_EQ(io.written, sizeof(rtcMem::rtcData) + BLOCK_BYTES);
+
+	startWake(valid);
+	checkRecords({0, 1, 2, 3, 4, -1, -1, -1, -1, -1, 10});
+	// Found valid this time, so not written again
+	CHECK_EQ(endWake().written, sizeof(rtcMem::rtcData));
+
+	// A corrupted header drops everything without reading the blocks
+	ESP.rtcMemory[8] ^= 0x01;
+	CHECK_EQ(startWake(valid), sizeof(rtcMem::rtcData));
+	CHECK(!valid);
+	CHECK_EQ(gRTC.stored_records, 0);
+	endWake();
+}
+
+void testWrapAround() {
+	memset(ESP.rtcMemory, 0, sizeof(ESP.rtcMemory));
+	bool valid;
+	startWake(valid);
+	for (int32_t n = 0; n < STORED_RECORDS + 3; n++) {
+		rtcMem::push_record(record(n));
+	}
+	// Full store dropped the 3 oldest ones
+	CHECK_EQ(gRTC.stored_records, STORED_RECORDS);
+	CHECK_EQ(gRTC.first_record, 3);
+	CHECK_EQ(gRTC.record_seq, static_cast<uint32_t>(STORED_RECORDS + 3));
+	CHECK(rtcMem::record_at(0) != nullptr && rtcMem::record_at(0)->temperature == 3);
+	CHECK(rtcMem::record_at(STORED_RECORDS - 1) != nullptr && rtcMem::record_at(STORED_RECORDS - 1)->temperature == STORED_RECORDS + 2);
+	endWake();
+
+	// Releasing past the end of the ring wraps the cursor and clears the released slots
+	startWake(valid);
+	uint16_t const seq = gRTC.batch_seq;
+	rtcMem::release_records(STORED_RECORDS - 1);
+	CHECK_EQ(gRTC.batch_seq, seq + 1);
+	CHECK_EQ(gRTC.first_record, 2);
+	CHECK_EQ(gRTC.stored_records, 1);
+	CHECK(rtcMem::record_at(0) != nullptr && rtcMem::record_at(0)->temperature == STORED_RECORDS + 2);
+	for (uint8_t i = 1; i < STORED_RECORDS; i++) {
+		CHECK(rtcMem::record_at(i) == nullptr);
+	}
+	endWake();
+
+	// Still cleared after the next wake, i.e. written back
+	startWake(valid);
+	for (uint8_t i = 1; i < STORED_RECORDS; i++) {
+		CHECK(rtcMem::record_at(i) == nullptr);
+	}
+	// More than stored only releases what is there
+	rtcMem::release_records(5);
+	CHECK_EQ(gRTC.stored_records, 0);
+	CHECK_EQ(gRTC.first_record, 3);
+	endWake();
+}
+
+void testAnchor() {
+	memset(ESP.rtcMemory, 0, sizeof(ESP.rtcMemory));
+	bool valid;
+	startWake(valid);
+	uint32_t const interval = runtimeConfig::current().interval_ms;
+	for (int32_t n = 0; n < 4; n++) {
+		rtcMem::push_record(record(n));
+	}
+	// The second release carries into the next million seconds
+	int32_t const step = static_cast<int32_t>(interval);
+	gRTC.anchor        = {1700, 1000000000 - step - step / 2};
+
+	// Follows the oldest stored record
+	rtcMem::release_records(1);
+	CHECK_EQ(gRTC.anchor.tv_millionsec, 1700);
+	CHECK_EQ(gRTC.anchor.tv_millisec, 1000000000 - step / 2);
+	rtcMem::release_records(1);
+	CHECK_EQ(gRTC.anchor.tv_millionsec, 1701);
+	CHECK_EQ(gRTC.anchor.tv_millisec, step / 2);
+
+	// Dropping the oldest record of a full store moves it as well
+	for (int32_t n = 4; n < STORED_RECORDS + 2; n++) {
+		rtcMem::push_record(record(n));
+	}
+	CHECK_EQ(gRTC.anchor.tv_millisec, step / 2);
+	rtcMem::push_record(record(STORED_RECORDS + 2));
+	CHECK_EQ(gRTC.anchor.tv_millisec, step / 2 + step);
+	endWake();
+
+	startWake(valid);
+	CHECK(gRTC.anchor.is_set());
+	// Cleared once the store runs empty, the next upload resyncs with the timeserver
+	rtcMem::release_records(gRTC.stored_records);
+	CHECK(!gRTC.anchor.is_set());
+
+	rtcMem::push_record(record(0));
+	gRTC.anchor = {1700, 0};
+	rtcMem::clear_records();
+	CHECK(!gRTC.anchor.is_set());
+	CHECK(rtcMem::record_at(0) == nullptr);
+	endWake();
+}
+}   // namespace
+
+auto main() -> int {
+	testFreshStore();
+	testWakeIo();
+	testCorruptedBlock();
+	testWrapAround();
+	testAnchor();
+	printf("%s\n", checkFailures == 0 ? "OK" : "FAILED");
+	return checkFailures == 0 ? 0 : 1;
+}
@@ -0,0 +1,108 @@
+#include "bme280_aggregator.hpp"
+#include "bme280_sim.hpp"
+#include "host/check.hpp"
+
+/*
+	BME280Aggregator against the register model, the same code the firmware runs with USE_SIM_SENSOR.
+ */
+using SimBus = BME280I2CBusT<BME280Sim>;
+using BME    = BME280Aggregator<SimBus>;
+
+namespace {
+void testInitAndRead() {
+	BME280Sim sim;
+	sim.setTimeSource(micros);
+	BME bme;
+	CHECK(bme.begin(SimBus(0x76, &sim)));
+	CHECK_EQ(bme.sensorID(), 0x60u);
+	auto const init = sim.stats();
+	printf("init: %u transactions, %u bytes, %u us on the wire\n", init.transactions, init.bytesWritten + init.bytesRead, init.busTimeUs);
+
+	sim.resetStats();
+	auto const data = bme.readAllSensors();
+	// Burst read of 0xF7..0xFE: pointer write + read
+	CHECK_EQ(sim.stats().transactions, 2u);
+	CHECK_EQ(sim.stats().bytesRead, 8u);
+	printf("readAllSensors: %u transactions, %u us on the wire\n", sim.stats().transactions, sim.stats().busTimeUs);
+	// Datasheet example readings (DS 8.1): 25.08 DegC, 100653 Pa
+	CHECK_NEAR(data.getTemp() / 1000.0, 25.08, 0.01);
+	CHECK_NEAR(data.getPress() / 100.0, 100653, 1);
+	CHECK(data.getHum() > 0 && data.getHum() < 10000);
+}
+
+void testNormalModeCycle() {
+	BME280Sim sim;
+	sim.setTimeSource(micros);
+	SimBus bus(0x76, &sim);
+	BME    bme;
+	CHECK(bme.begin(bus));
+
+	// x1 everywhere: 8 ms per conversion (DS 9.1 typical), then 1 s standby
+	bus.write8(0xE0, 0xB6);
+	delay(3);
+	bme.setSampling(BME::MODE_NORMAL, BME::SAMPLING_X1, BME::SAMPLING_X1, BME::SAMPLING_X1, BME::FILTER_OFF, BME::STANDBY_MS_1000);
+	uint8_t raw[8];
+	bus.read(0xF7, raw, sizeof(raw));
+	CHECK_EQ(raw[0], 0x80);
+	CHECK_EQ(raw[3], 0x80);
+	CHECK_EQ(raw[6], 0x80);
+	uint8_t status;
+	bus.read(0xF3, &status, 1);
+	CHECK_EQ(status & 0x08, 0x08);
+
+	delay(10);
+	auto const first = bme.readAllSensors();
+	CHECK_NEAR(first.getTemp() / 1000.0, 25.08, 0.01);
+
+	// Next conversion only after the standby time
+	sim.setRawSample(519888 + 16000, 415148, 0x6E5A);
+	delay(500);
+	CHECK_EQ(bme.readAllSensors().getTemp(), first.getTemp());
+	delay(600);
+	CHECK(bme.readAllSensors().getTemp() > first.getTemp());
+}
+
+void testForcedConversionTime() {
+	BME280Sim sim;
+	sim.setTimeSource(micros);
+	BME bme;
+	CHECK(bme.begin(SimBus(0x76, &sim)));
+	// Default profile x8/x4/x4: 1 + 2 * 8 + (2 * 4 + 0.5) * 2 ms
+	CHECK_NEAR(bme.timeForcedConversion(), 34000, 500);
+}
+
+void testFormatting() {
+	char buf[96];
+	// -1.2 DegC, 100653 Pa, 45.5 %RH in compensated units
+	sensor_data const data = {-30720, 25767168, 46592};
+	data.printTo(buf, sizeof(buf));
+	CHECK(strcmp(buf, "temperature=-1.200,pressure=100653.00,humidity=0.4550") == 0);
+	printFixed(buf, sizeof(buf), -5, 3);
+	CHECK(strcmp(buf, "-0.005") == 0);
+	printFixed(buf, sizeof(buf), 12345, 2);
+	CHECK(strcmp(buf, "123.45") == 0);
+}
+
+void testFaults() {
+	BME280Sim sim;
+	sim.setTimeSource(micros);
+	BME bme;
+	sim.nackNext(1);
+	CHECK(!bme.begin(SimBus(0x76, &sim)));
+
+	sim.setStuckBusy(true);
+	CHECK(!bme.begin(SimBus(0x76, &sim)));
+	sim.setStuckBusy(false);
+	CHECK(bme.begin(SimBus(0x76, &sim)));
+}
+}   // namespace
+
+auto main() -> int {
+	testInitAndRead();
+	testNormalModeCycle();
+	testForcedConversionTime();
+	testFormatting();
+	testFaults();
+	printf("%s\n", checkFailures == 0 ? "OK" : "FAILED");
+	return checkFailures == 0 ? 0 : 1;
+}
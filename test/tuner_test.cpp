@@ -0,0 +1,205 @@
+#include <EEPROM.h>
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "bme280_sim.hpp"
+#include "host/check.hpp"
+#include "sensor_tuner.hpp"
+
+/*
+	sensorTuner::run against the simulator's noise and IIR model, checked from the table it prints.
+ */
+using SimBus = BME280I2CBusT<BME280Sim>;
+using BME    = BME280Aggregator<SimBus>;
+
+namespace {
+enum { CH_T, CH_P, CH_H, CHANNELS };
+
+const uint32_t kTargets[CHANNELS] = {TUNE_NOISE_T, TUNE_NOISE_P, TUNE_NOISE_H};
+
+typedef struct {
+	char     mark;
+	unsigned osrs[CHANNELS];   // factors x1..x16
+	unsigned filter;           // coefficient, 0 => off
+	unsigned conversion_us;
+	unsigned max_us;
+	unsigned settle_ms;
+	unsigned noise[CHANNELS];
+} row;
+
+auto parseRows(const std::string& output) -> std::vector<row> {
+	std::vector<row>   rows;
+	std::istringstream lines(output);
+	std::string        line;
+	while (std::getline(lines, line)) {
+		row  r;
+		char filter[4];
+		if (sscanf(line.c_str(),
+				   "%c x%u x%u x%u %3s %u %u %u %u %u %u",
+				   &r.mark,
+				   &r.osrs[CH_T],
+				   &r.osrs[CH_P],
+				   &r.osrs[CH_H],
+				   filter,
+				   &r.conversion_us,
+				   &r.max_us,
+				   &r.settle_ms,
+				   &r.noise[CH_T],
+				   &r.noise[CH_P],
+				   &r.noise[CH_H]) == 11) {
+			r.filter = strcmp(filter, "off") == 0 ? 0 : atoi(filter + 1);
+			rows.push_back(r);
+		}
+	}
+	return rows;
+}
+
+auto meets(const row& r) -> bool {
+	for (uint8_t ch = 0; ch < CHANNELS; ch++) {
+		if (r.noise[ch] > kTargets[ch]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Register code of an oversampling factor, x1 => 1 .. x16 => 5
+auto osrsCode(unsigned factor) -> uint8_t {
+	uint8_t c = 0;
+	while (factor > 0) {
+		factor >>= 1;
+		c++;
+	}
+	return c;
+}
+
+// Register code of a filter coefficient, off => 0, x2 => 1 .. x16 => 4
+auto filterCode(unsigned coefficient) -> uint8_t {
+	return coefficient == 0 ? 0 : osrsCode(coefficient) - 1;
+}
+
+auto tune(BME280Sim& sim) -> std::vector<row> {
+	sim.setTimeSource(micros);
+	SimBus bus(0x76, &sim);
+	BME    bme;
+	Serial.output.clear();
+	sensorTuner::run(bme, bus);
+	return parseRows(Serial.output);
+}
+
+void testCandidates() {
+	EEPROM.erase();
+	BME280Sim sim;
+	// About 22 mC, 360 cPa and 28 c%RH of noise at x1: the cheapest candidate misses a target, the next one is stored
+	sim.setNoise(60, 6, 40, 7);
+	auto const rows = tune(sim);
+
+	std::vector<row> sweep, candidates;
+	for (auto const& r : rows) {
+		(r.mark == '*' ? candidates : sweep).push_back(r);
+	}
+	CHECK_EQ(sweep.size(), 25u);
+	CHECK(!candidates.empty() && candidates.size() <= 5);
+	if (sweep.size() != 25) {
+		return;
+	}
+
+	// Filter major, codes 0..4 print as off, x2, x4, x8, x16
+	unsigned const filters[] = {0, 2, 4, 8, 16};
+	for (size_t i = 0; i < sweep.size(); i++) {
+		CHECK_EQ(sweep[i].filter, filters[i / 5]);
+		CHECK_EQ(sweep[i].osrs[CH_T], 1u << (i % 5));
+	}
+	// Oversampling and the filter both reduce the noise
+	CHECK(sweep[4].noise[CH_P] < sweep[0].noise[CH_P]);
+	CHECK(sweep[20].noise[CH_P] < sweep[0].noise[CH_P]);
+	// Humidity isn't filtered
+	CHECK_NEAR(sweep[20].noise[CH_H], sweep[0].noise[CH_H], sweep[0].noise[CH_H] / 2.0);
+
+	// Each candidate is the lowest oversampling per channel meeting the target with its filter, x16 if none did
+	for (auto const& candidate : candidates) {
+		size_t const base = filterCode(candidate.filter) * 5;
+		CHECK(base < sweep.size());
+		for (uint8_t ch = 0; ch < CHANNELS && base < sweep.size(); ch++) {
+			unsigned expected = 16;
+			for (size_t osrs = 0; osrs < 5; osrs++) {
+				if (sweep[base + osrs].noise[ch] <= kTargets[ch]) {
+					expected = 1u << osrs;
+					break;
+				}
+			}
+			CHECK_EQ(candidate.osrs[ch], expected);
+		}
+	}
+	// Cheapest first
+	for (size_t i = 1; i < candidates.size(); i++) {
+		CHECK(candidates[i - 1].settle_ms <= candidates[i].settle_ms);
+	}
+
+	// The first one meeting all targets is stored, the search stops there
+	CHECK(meets(candidates.back()));
+	for (size_t i = 0; i + 1 < candidates.size(); i++) {
+		CHECK(!meets(candidates[i]));
+	}
+	runtime_config cfg = {};
+	CHECK(sensorTuner::load(cfg));
+	CHECK_EQ(cfg.osrs_t, osrsCode(candidates.back().osrs[CH_T]));
+	CHECK_EQ(cfg.osrs_p, osrsCode(candidates.back().osrs[CH_P]));
+	CHECK_EQ(cfg.osrs_h, osrsCode(candidates.back().osrs[CH_H]));
+	CHECK_EQ(cfg.filter, filterCode(candidates.back().filter));
+	printf("stored osrs %u/%u/%u filter %u, %zu candidates measured\n",
+		   cfg.osrs_t,
+		   cfg.osrs_p,
+		   cfg.osrs_h,
+		   cfg.filter,
+		   candidates.size());
+
+	// Same sensor, same profile: no flash write
+	uint32_t const commits = EEPROM.commits;
+	BME280Sim      again;
+	again.setNoise(60, 6, 40, 7);
+	tune(again);
+	CHECK_EQ(EEPROM.commits, commits);
+	CHECK(Serial.output.find("Same as stored") != std::string::npos);
+}
+
+void testSensorBudget() {
+	EEPROM.erase();
+	BME280Sim sim;
+	// Only filter x16 gets the noise down, which settles longer than a wake's sensor phase may take
+	sim.setNoise(300, 30, 40, 7);
+	auto const rows = tune(sim);
+	for (auto const& r : rows) {
+		if (r.mark == '*') {
+			CHECK(r.settle_ms <= TUNE_SETTLE_MAX_MS);
+		}
+	}
+	CHECK(Serial.output.find("more than the") != std::string::npos);
+	runtime_config cfg = {};
+	CHECK(!sensorTuner::load(cfg));
+}
+
+void testNoiseless() {
+	EEPROM.erase();
+	BME280Sim sim;
+	auto const rows = tune(sim);
+	CHECK(!rows.empty() && rows.back().mark == '*');
+	runtime_config cfg = {};
+	CHECK(sensorTuner::load(cfg));
+	// Everything meets the targets, the cheapest profile wins
+	CHECK_EQ(cfg.osrs_t, 1);
+	CHECK_EQ(cfg.osrs_p, 1);
+	CHECK_EQ(cfg.osrs_h, 1);
+	CHECK_EQ(cfg.filter, 0);
+}
+}   // namespace
+
+auto main() -> int {
+	testCandidates();
+	testSensorBudget();
+	testNoiseless();
+	printf("%s\n", checkFailures == 0 ? "OK" : "FAILED");
+	return checkFailures == 0 ? 0 : 1;
+}
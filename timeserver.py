@@ -1,14 +1,183 @@
+import asyncio
+import gzip
+import hashlib
+import json
+import os
+import struct
 import time
 from aiohttp import web
 
 """
 	Simple http server that returns the current time as milliseconds
+
+	Nodes pass their chip id and the version of the config they run (?id=<chipid>&cfg=<version>).
+	If configs.json (next to this file) has a config for the node ("<chipid>" or "default") with a
+	different version, it is appended as a second line, see runtime_config.hpp:
+
+	{
+		"default": {"version": 2, "interval": 20000, "limit": 20, "osrs": [4, 3, 3], "filter": 0, "chunk": 512, "attempt": 1000},
+		"1234567": {"version": 3, "interval": 60000, "limit": 10, "osrs": [1, 1, 1], "filter": 0, "chunk": 1024, "attempt": 500}
+	}
+
+	/firmware serves builds to USE_PULL_OTA nodes (see ota_pull.hpp), which pass the MD5 of the build they run
+	(?id=<chipid>&md5=<md5>). firmware/latest.bin (next to this file, e.g. a symlink) is the build to roll out, every
+	other *.bin in firmware/ is kept as a base for deltas. Keep the builds nodes are running there, nodes whose build
+	isn't known get the gzip image. Whichever of the two is smaller is sent.
 """
 
+CONFIG_FILE = os.path.join(os.path.dirname(os.path.abspath(__file__)), "configs.json")
+FIRMWARE_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), "firmware")
+
+DELTA_BLOCK = 16      # Bytes hashed to find matches
+DELTA_STEP = 4        # Base offsets indexed
+DELTA_MIN_COPY = 32   # Shorter matches cost more as an op than as literal bytes
+
+
+def load_configs():
+    try:
+        with open(CONFIG_FILE) as f:
+            return json.load(f)
+    except FileNotFoundError:
+        return {}
+
+
+def config_line(cfg):
+    return "cfg v=%d interval=%d limit=%d osrs=%d,%d,%d filter=%d chunk=%d attempt=%d" % (
+        cfg["version"], cfg["interval"], cfg["limit"], *cfg["osrs"], cfg["filter"], cfg["chunk"], cfg["attempt"])
+
+
+class Builds:
+    """Builds in FIRMWARE_DIR by MD5, reread when files change. Images and deltas are cached."""
+
+    def __init__(self):
+        self.files = {}    # path => (mtime, md5)
+        self.images = {}   # md5 => bytes
+        self.cache = {}    # (base md5, target md5) => (type, body, md5 of what is written to flash)
+
+    def scan(self):
+        by_md5 = {}
+        for name in os.listdir(FIRMWARE_DIR) if os.path.isdir(FIRMWARE_DIR) else []:
+            path = os.path.join(FIRMWARE_DIR, name)
+            if not name.endswith(".bin") or not os.path.isfile(path):
+                continue
+            mtime = os.path.getmtime(path)
+            if self.files.get(path, (None,))[0] != mtime:
+                with open(path, "rb") as f:
+                    data = f.read()
+                md5 = hashlib.md5(data).hexdigest()
+                self.files[path] = (mtime, md5)
+                self.images[md5] = data
+            by_md5[self.files[path][1]] = path
+        return by_md5
+
+    def latest(self):
+        self.scan()
+        path = os.path.join(FIRMWARE_DIR, "latest.bin")
+        return self.files[path][1] if os.path.isfile(path) else None
+
+    def image_for(self, base, target):
+        # Only known bases get deltas, every other md5 a node reports gets the same gzip image
+        key = (base if base in self.images else None, target)
+        if key not in self.cache:
+            image = self.images[target]
+            packed = gzip.compress(image, 9)
+            best = ("gzip", packed, hashlib.md5(packed).hexdigest())
+            if base in self.images:
+                delta = make_delta(self.images[base], image)
+                if len(delta) < len(packed) and apply_delta(self.images[base], delta) == image:
+                    best = ("delta", delta, target)
+            self.cache[key] = best
+        return self.cache[key]
+
+
+def match_length(a, ai, b, bi):
+    limit = min(len(a) - ai, len(b) - bi)
+    n = 0
+    while n + 256 <= limit and a[ai + n:ai + n + 256] == b[bi + n:bi + n + 256]:
+        n += 256
+    while n < limit and a[ai + n] == b[bi + n]:
+        n += 1
+    return n
+
+
+def make_delta(base, target):
+    """Copy/add ops rebuilding target from base, format see ota_pull.hpp"""
+    index = {}
+    for offset in range(len(base) - DELTA_BLOCK, -1, -DELTA_STEP):
+        index[base[offset:offset + DELTA_BLOCK]] = offset
+    out = bytearray(b"EDLT" + struct.pack("<I", len(target)))
+
+    def add(data):
+        if data:
+            out.extend(b"A" + struct.pack("<I", len(data)) + data)
+
+    literal = 0
+    i = 0
+    while i + DELTA_BLOCK <= len(target):
+        source = index.get(target[i:i + DELTA_BLOCK])
+        if source is None:
+            i += 1
+            continue
+        # The match may start before the indexed offset
+        start = i
+        while start > literal and source > 0 and target[start - 1] == base[source - 1]:
+            start -= 1
+            source -= 1
+        length = match_length(base, source, target, start)
+        if length < DELTA_MIN_COPY:
+            i += 1
+            continue
+        add(target[literal:start])
+        out.extend(b"C" + struct.pack("<II", length, source))
+        i = literal = start + length
+    add(target[literal:])
+    return bytes(out)
+
+
+def apply_delta(base, delta):
+    """What the node does, a delta is only sent if it rebuilds the image"""
+    magic, size = struct.unpack_from("<4sI", delta)
+    assert magic == b"EDLT"
+    out = bytearray()
+    pos = 8
+    while len(out) < size:
+        op, length = struct.unpack_from("<cI", delta, pos)
+        pos += 5
+        if op == b"C":
+            source, = struct.unpack_from("<I", delta, pos)
+            pos += 4
+            out += base[source:source + length]
+        else:
+            out += delta[pos:pos + length]
+            pos += length
+    return bytes(out)
+
+
+builds = Builds()
+
+
+async def firmware(request):
+    latest = builds.latest()
+    running = request.query.get("md5", "")
+    if latest is None or running == latest:
+        return web.Response(status=304)
+    # Delta encoding and gzip take a while for a new pair, time requests of other nodes must not wait for that
+    kind, body, md5 = await asyncio.get_running_loop().run_in_executor(None, builds.image_for, running, latest)
+    print("%s: %s -> %s, %s of %d bytes" % (request.query.get("id", "?"), running, latest, kind, len(body)))
+    return web.Response(body=body, content_type="application/octet-stream",
+                        headers={"X-Image-Type": kind, "X-Image-MD5": md5})
+
+
 async def hello(request):
-    return web.Response(text=str(int(time.time()*1000)))
+    text = str(int(time.time()*1000))
+    # Reread on every request, so configs can be changed without restarting
+    configs = load_configs()
+    cfg = configs.get(request.query.get("id", ""), configs.get("default"))
+    if cfg is not None and str(cfg["version"]) != request.query.get("cfg"):
+        text += "\n" + config_line(cfg)
+    return web.Response(text=text)
 
 app = web.Application()
-app.add_routes([web.get('/', hello)])
+app.add_routes([web.get('/', hello), web.get('/firmware', firmware)])
 
-web.run_app(app, port=8000)
\ No newline at end of file
+web.run_app(app, port=8000)
@@ -0,0 +1,65 @@
+#include "tls_session.hpp"
+
+#ifdef USE_TLS
+#include <algorithm>
+
+#include "debug.hpp"
+#include "rtc_mem.hpp"
+
+namespace tlsSession {
+namespace {
+// Both are referenced by the client until it is destroyed
+BearSSL::PublicKey serverKey(TLS_PUBKEY);
+BearSSL::Session   session;
+
+// Session as offered to the server, a resumed handshake leaves it untouched
+uint8_t offered[TLS_SESSION_BYTES];
+bool    haveOffered = false;
+
+// Measured by report(), stored by save() so a report still being sent isn't overwritten
+uint16_t requestMs = 0;
+bool     resumed   = false;
+
+// Only the session parameters are cached, not the layout of BearSSL::Session
+static_assert(sizeof(br_ssl_session_parameters) <= TLS_SESSION_BYTES, "TLS_SESSION_BYTES too small for the session parameters");
+
+auto sessionBytes() -> uint8_t* {
+	return reinterpret_cast<uint8_t*>(session.getSession());
+}
+}   // namespace
+
+void prepare(BearSSL::WiFiClientSecure& client) {
+	memset(offered, 0, sizeof(offered));
+	haveOffered = rtcMem::load_tls_session(offered);
+	if (haveOffered) {
+		memcpy(sessionBytes(), offered, sizeof(br_ssl_session_parameters));
+	} else {
+		LOGI(LOG_MOD_NET, "No cached TLS session, full handshake");
+	}
+	client.setKnownKey(&serverKey);
+	client.setSession(&session);
+}
+
+void report(uint32_t request_ms) {
+	resumed   = haveOffered && memcmp(sessionBytes(), offered, sizeof(br_ssl_session_parameters)) == 0;
+	requestMs = std::min<uint32_t>(std::max<uint32_t>(request_ms, 1), UINT16_MAX);
+	LOGI(LOG_MOD_NET, "TLS handshake: %s, first request took %d ms", resumed ? "resumed" : "full", request_ms);
+}
+
+void save() {
+	if (requestMs != 0) {
+		rtcMem::gRTC.tls_request_ms = requestMs;
+		rtcMem::gRTC.tls_resumed    = resumed;
+		requestMs                   = 0;
+	}
+	uint8_t bytes[TLS_SESSION_BYTES] = {0};
+	memcpy(bytes, sessionBytes(), sizeof(br_ssl_session_parameters));
+	if (haveOffered && memcmp(bytes, offered, sizeof(bytes)) == 0) {
+		return;
+	}
+	if (!rtcMem::store_tls_session(bytes)) {
+		LOGW(LOG_MOD_NET, "Caching TLS session failed");
+	}
+}
+}   // namespace tlsSession
+#endif
@@ -0,0 +1,30 @@
+#pragma once
+
+// Before config.hpp, SSID is also a method of the WiFi classes
+#include <ESP8266WiFi.h>
+
+#include "config.hpp"
+
+#ifdef USE_TLS
+#include <WiFiClientSecureBearSSL.h>
+
+/*
+	TLS for the uploads to DB_URL:
+	 - the server key is pinned to TLS_PUBKEY, no certificate chain is validated, so neither a CA store
+	   nor a valid clock (we only learn the time from TS_URL) is needed
+	 - the session negotiated on an upload wake is cached in RTC memory (rtcTlsBlock) and offered again on
+	   the next one. If the server still knows it, the handshake skips the key exchange, which takes seconds
+	   of CPU time with a full handshake on the ESP8266.
+ */
+namespace tlsSession {
+// Pins the key and hands the cached session (if any) to client, call before the first request
+void prepare(BearSSL::WiFiClientSecure& client);
+
+// Logs whether the session offered was resumed, call once the first request got a response.
+// request_ms (handshake included) is reported with the next upload, see gRTC.tls_request_ms.
+void report(uint32_t request_ms);
+
+// Caches the session negotiated during this wake and the measurement of report() for the next one
+void save();
+}   // namespace tlsSession
+#endif
@@ -0,0 +1,89 @@
+#include "wake_budget.hpp"
+
+#include <algorithm>
+
+#include "debug.hpp"
+#include "rtc_mem.hpp"
+
+namespace wakeBudget {
+namespace {
+const uint32_t kBudgets[] = {BUDGET_SENSOR_MS, BUDGET_ASSOC_MS, BUDGET_TIMESYNC_MS, BUDGET_UPLOAD_MS, BUDGET_UPDATE_MS};
+const char*    kNames[]   = {"sensor", "assoc", "timesync", "upload", "update"};
+
+static_assert(sizeof(kBudgets) / sizeof(kBudgets[0]) == static_cast<size_t>(wakePhase::count), "Budget missing for a phase");
+
+wakePhase current   = wakePhase::count;   // count => no phase running
+uint32_t  wakeStart = 0;                  // millis() the WAKE_BUDGET_MS cap counts from
+uint32_t  started   = 0;
+uint32_t  deadline  = 0;
+bool      blown     = false;
+
+void markBlown() {
+	if (blown) {
+		return;
+	}
+	blown         = true;
+	uint8_t& slot = rtcMem::gRTC.budget_blown[static_cast<uint8_t>(current)];
+	if (slot < UINT8_MAX) {
+		slot++;
+	}
+	LOGW(LOG_MOD_MAIN, "Phase %s out of time", name(current));
+}
+}   // namespace
+
+void startWake() {
+	wakeStart = millis();
+}
+
+void begin(wakePhase phase) {
+	end();
+	current  = phase;
+	started  = millis();
+	deadline = started + kBudgets[static_cast<uint8_t>(phase)];
+	if (phase != wakePhase::update) {
+		deadline = std::min<uint32_t>(deadline, wakeStart + WAKE_BUDGET_MS);
+	}
+	blown = false;
+}
+
+void end() {
+	if (current == wakePhase::count) {
+		return;
+	}
+	if (remaining() == 0) {
+		markBlown();
+	}
+	LOGI(LOG_MOD_MAIN, "Phase %s took %d ms%s", name(current), millis() - started, blown ? ", over budget" : "");
+	current = wakePhase::count;
+}
+
+auto remaining() -> uint32_t {
+	if (current == wakePhase::count) {
+		return UINT32_MAX;
+	}
+	// millis() counts from boot, it doesn't wrap within a wake
+	uint32_t const now = millis();
+	return now < deadline ? deadline - now : 0;
+}
+
+auto expired() -> bool {
+	if (current == wakePhase::count || remaining() > 0) {
+		return false;
+	}
+	markBlown();
+	return true;
+}
+
+auto timeout() -> uint16_t {
+	if (current == wakePhase::count) {
+		// Not within a wake (USE_ESPNOW_GATEWAY), keep HTTPClient's default
+		return 5000;
+	}
+	// Never 0, callers check expired() before starting a request anyway
+	return std::max<uint32_t>(1, std::min<uint32_t>(remaining(), UINT16_MAX));
+}
+
+auto name(wakePhase phase) -> const char* {
+	return phase < wakePhase::count ? kNames[static_cast<uint8_t>(phase)] : "none";
+}
+}   // namespace wakeBudget
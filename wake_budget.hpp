@@ -0,0 +1,47 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "config.hpp"
+
+/*
+	Caps the time a wake keeps the node (and its radio) up. Each phase gets a deadline from its own budget
+	(BUDGET_*_MS in config.hpp), but never later than WAKE_BUDGET_MS after the wake started (boot, or startWake()):
+	 - blocking calls take their timeout from remaining(): WiFiClient::setTimeout for DNS and TCP connect,
+	   HTTPClient::setTimeout for the response
+	 - loops (AP attempts, retries, upload chunks) check expired() and give up
+	Giving up is the regular deferral path: records stay stored and are uploaded on a later wake.
+	The update phase (ota_pull.hpp) is the exception to the WAKE_BUDGET_MS cap, it only runs on the rare wakes that
+	install a new build.
+	A phase running out of time is counted in RTC memory (gRTC.budget_blown) and reported with the next upload.
+ */
+enum class wakePhase : uint8_t {
+	sensor = 0,
+	assoc,
+	timesync,
+	upload,
+	update,
+	count
+};
+
+namespace wakeBudget {
+// Restarts the WAKE_BUDGET_MS cap from now, for wakes that did something else first (sensor tuning)
+void startWake();
+
+// Starts phase, ends the previous one
+void begin(wakePhase phase);
+
+// Ends the current phase, logs the time it took. A phase that ended past its deadline counts as blown as well.
+void end();
+
+// ms until the current phase has to be done, 0 once it's over, UINT32_MAX outside of phases
+auto remaining() -> uint32_t;
+
+// True once the current phase is out of time, the first call that notices counts it as blown
+auto expired() -> bool;
+
+// remaining() as a timeout for WiFiClient::setTimeout and HTTPClient::setTimeout
+auto timeout() -> uint16_t;
+
+auto name(wakePhase phase) -> const char*;
+}   // namespace wakeBudget
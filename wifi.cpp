@@ -1,86 +1,137 @@
 #include "wifi.hpp"
 
+#include <algorithm>
+
 #include "config.hpp"
 #include "debug.hpp"
 #include "rtc_mem.hpp"
+#include "runtime_config.hpp"
+#include "wake_budget.hpp"
+
+namespace {
+// Prefer APs that worked before and had a good signal, push back the ones that failed recently
+auto apScore(const rtcMem::apCacheEntry &ap) -> int {
+	return ap.rssi + 5 * std::min<int>(ap.successes, 10) - 30 * ap.failures;
+}
+}   // namespace
 
 ESaveWifi::ESaveWifi() {
 	m_wifi.mode(WIFI_OFF);
 	m_wifi.forceSleepBegin();
 	delay(1);
-	m_isOn = false;
+	m_isOn         = false;
+	m_candidates   = 0;
+	m_attempt      = 0;
+	m_connectStart = 0;
+	m_attemptStart = 0;
+	m_associatedAt = 0;
+	m_associated   = false;
+	m_onAssociated = m_wifi.onStationModeConnected([this](const WiFiEventStationModeConnected &) {
+		m_associatedAt = millis();
+		m_associated   = true;
+	});
 }
 
 auto ESaveWifi::turnOn() -> bool {
-	using rtcMem::gRTC;
 	if (m_isOn) {
-		LOGLN("!!ERROR!! Wifi is already enabled.");
+		LOGE(LOG_MOD_WIFI, "Wifi is already enabled.");
 		return true;
 	}
 	// TODO(dominik): Check if we can get rid of dhcp by also caching ip + netconfig
-	LOGLN("Starting WiFi");
+	LOGI(LOG_MOD_WIFI, "Starting WiFi");
 	m_wifi.forceSleepWake();
 	delay(1);
 	m_wifi.persistent(false);
 	m_wifi.mode(WIFI_STA);
 
-	LOGLN("Connecting to ");
-	LOGLN(SSID);
+	LOGI(LOG_MOD_WIFI, "Connecting to %s", SSID);
+	m_connectStart = millis();
+	m_candidates   = 0;
+	m_attempt      = 0;
 	if (rtcMem::is_valid()) {
-		LOGLN("Quickconnect");
+		rankCache();
+	}
+	if (m_candidates > 0) {
+		LOGI(LOG_MOD_WIFI, "Quickconnect");
 		// FIXME: WHile this preconfig can speed up things quite a bit, it runs into issues when dns changes
-		// Probably requires fixed router setup/IP Assignment?
+		// Probably requires fixed router setup/IP Assignment? The addresses would have to go back into rtcData.
 		// m_wifi.config( gRTC.ip_addr, gRTC.gateway_addr, gRTC.netmask, gRTC.dns_addr );
 		// The RTC data was good, make a quick connection
-		m_wifi.begin(SSID, PSK, gRTC.channel, gRTC.bssid, true);
+		beginCached(0);
 	} else {
-		// The RTC data was not valid, so make a regular connection
-		m_wifi.begin(SSID, PSK);
+		// No known AP, so make a regular connection
+		beginAny();
 	}
+	return true;
 }
 
-auto ESaveWifi::checkStatus() -> bool {
-	// TODO(dominik): This conflates with the above method...it also tries to connect
-	using rtcMem::gRTC;
-	int retries    = 0;
-	int wifiStatus = m_wifi.status();
-	while (wifiStatus != WL_CONNECTED) {
-		retries++;
-		if (retries == 100) {
-			LOGLN("Quick connect is not working, reset WiFi and try regular connection!");
-			m_wifi.disconnect();
-			delay(10);
-			m_wifi.forceSleepBegin();
-			delay(10);
-			m_wifi.forceSleepWake();
-			delay(10);
-			m_wifi.begin(SSID, PSK);
+auto ESaveWifi::turnOnRadio(uint8_t channel) -> bool {
+	if (channel == 0) {
+		m_candidates = 0;
+		if (rtcMem::is_valid()) {
+			rankCache();
 		}
-		if (retries == 200) {
-			LOGLN("Could not connect to WiFi!");
-			m_isOn = false;
+		if (m_candidates == 0) {
+			LOGW(LOG_MOD_WIFI, "No cached AP, channel unknown");
 			return false;
 		}
-		delay(50);
-		wifiStatus = m_wifi.status();
+		channel = rtcMem::gRTC.ap_cache[m_order[0]].channel;
 	}
-	LOGF("WiFi Connected, r:%d\n", retries);
-	LOGLN("Got IP: ");
-	LOGLN(m_wifi.localIP());
-	// Cache WiFi information
-	gRTC.ip_addr      = (uint32_t)m_wifi.localIP();
-	gRTC.gateway_addr = (uint32_t)m_wifi.gatewayIP();
-	gRTC.netmask      = (uint32_t)m_wifi.subnetMask();
-	gRTC.ip_addr      = (uint32_t)m_wifi.dnsIP();
-	gRTC.dns_addr     = m_wifi.channel();
-	memcpy(gRTC.bssid, m_wifi.BSSID(), 6);   // Copy 6 bytes of BSSID (AP's MAC address)
+	LOGI(LOG_MOD_WIFI, "Radio on, channel %d", channel);
+	m_wifi.forceSleepWake();
+	delay(1);
+	m_wifi.persistent(false);
+	m_wifi.mode(WIFI_STA);
+	wifi_set_channel(channel);
+	// Counts as on, shutDown() powers the radio down again
 	m_isOn = true;
 	return true;
+}
+
+auto ESaveWifi::checkStatus() -> bool {
+	using rtcMem::gRTC;
+	if (m_candidates == 0) {
+		// turnOn already started a regular connection
+		if (waitConnected(WIFI_CONNECT_MS)) {
+			storeConnection();
+			return true;
+		}
+	} else {
+		// The attempt on the best cached AP was started by turnOn, walk through the others from here
+		while (true) {
+			if (waitConnected(runtimeConfig::current().wifi_attempt_ms)) {
+				storeConnection();
+				return true;
+			}
+			auto &ap = gRTC.ap_cache[m_order[m_attempt]];
+			if (ap.failures < UINT8_MAX) {
+				ap.failures++;
+			}
+			m_attempt++;
+			if (wakeBudget::expired() || millis() - m_connectStart >= WIFI_CONNECT_MS) {
+				m_isOn = false;
+				return false;
+			}
+			if (m_attempt == m_candidates) {
+				break;
+			}
+			m_wifi.disconnect();
+			beginCached(m_attempt);
+		}
+		LOGW(LOG_MOD_WIFI, "No cached AP is working, scanning for SSID");
+		if (scanAndConnect()) {
+			storeConnection();
+			return true;
+		}
+	}
+	LOGE(LOG_MOD_WIFI, "Could not connect to WiFi!");
+	m_isOn = false;
+	return false;
 };
 
 void ESaveWifi::shutDown() {
 	if (!m_isOn) {
-		LOGLN("!!ERROR!! Wifi is not enabled.");
+		LOGE(LOG_MOD_WIFI, "Wifi is not enabled.");
 		// No return here, shutdown should be executed anyway
 	}
 	m_wifi.disconnect(true);
@@ -92,4 +143,139 @@ void ESaveWifi::shutDown() {
 
 auto ESaveWifi::isOn() -> bool {
 	return m_isOn;
-};
\ No newline at end of file
+};
+
+void ESaveWifi::rankCache() {
+	using rtcMem::gRTC;
+	// Insertion sort of the used entries by score, the cache only has a handful of entries
+	m_candidates = 0;
+	for (uint8_t i = 0; i < WIFI_AP_CACHE; i++) {
+		if (gRTC.ap_cache[i].channel == 0) {
+			continue;
+		}
+		uint8_t pos = m_candidates++;
+		while (pos > 0 && apScore(gRTC.ap_cache[m_order[pos - 1]]) < apScore(gRTC.ap_cache[i])) {
+			m_order[pos] = m_order[pos - 1];
+			pos--;
+		}
+		m_order[pos] = i;
+	}
+}
+
+void ESaveWifi::beginCached(uint8_t attempt) {
+	auto &ap = rtcMem::gRTC.ap_cache[m_order[attempt]];
+	LOGI(LOG_MOD_WIFI,
+		 "Trying AP %06x%06x on channel %d (RSSI %d)",
+		 (ap.bssid[0] << 16) | (ap.bssid[1] << 8) | ap.bssid[2],
+		 (ap.bssid[3] << 16) | (ap.bssid[4] << 8) | ap.bssid[5],
+		 ap.channel,
+		 ap.rssi);
+	startAttempt();
+	m_wifi.begin(SSID, PSK, ap.channel, ap.bssid, true);
+}
+
+void ESaveWifi::beginAny() {
+	startAttempt();
+	m_wifi.begin(SSID, PSK);
+}
+
+void ESaveWifi::startAttempt() {
+	m_associated   = false;
+	m_attemptStart = millis();
+}
+
+auto ESaveWifi::waitConnected(uint32_t assocMs) -> bool {
+	int wifiStatus = m_wifi.status();
+	while (wifiStatus != WL_CONNECTED) {
+		uint32_t const now = millis();
+		// A slow DHCP server shouldn't cut the association short or vice versa
+		bool const timedOut = m_associated ? now - m_associatedAt >= WIFI_DHCP_MS : now - m_attemptStart >= assocMs;
+		// Don't wait for the timeout if the AP already told us it won't work
+		if (wifiStatus == WL_NO_SSID_AVAIL || wifiStatus == WL_CONNECT_FAILED || timedOut ||
+			now - m_connectStart >= WIFI_CONNECT_MS || wakeBudget::expired()) {
+			LOGW(LOG_MOD_WIFI,
+				 "Attempt failed after %d ms, status %d, %s",
+				 now - m_attemptStart,
+				 wifiStatus,
+				 m_associated ? "no address" : "not associated");
+			return false;
+		}
+		delay(10);
+		wifiStatus = m_wifi.status();
+	}
+	return true;
+}
+
+auto ESaveWifi::scanAndConnect() -> bool {
+	m_wifi.disconnect();
+	// Async, a scan over all channels takes about 2 s and has to stop with the budget
+	m_wifi.scanNetworks(true, false, 0, reinterpret_cast<uint8_t *>(const_cast<char *>(SSID)));
+	int8_t found;
+	while ((found = m_wifi.scanComplete()) == WIFI_SCAN_RUNNING) {
+		if (wakeBudget::expired() || millis() - m_connectStart >= WIFI_CONNECT_MS) {
+			LOGW(LOG_MOD_WIFI, "Scan out of time");
+			return false;
+		}
+		delay(10);
+	}
+	LOGI(LOG_MOD_WIFI, "Scan found %d APs", found);
+	for (int8_t i = 0; i < found; i++) {
+		rememberAP(m_wifi.BSSID(i), m_wifi.channel(i), m_wifi.RSSI(i), false);
+	}
+	m_wifi.scanDelete();
+
+	rankCache();
+	m_attempt = 0;
+	if (m_candidates > 0) {
+		beginCached(0);
+		if (waitConnected(runtimeConfig::current().wifi_attempt_ms)) {
+			return true;
+		}
+		// The scan results may be stale or the best AP refuses us, let the SDK pick any AP for SSID
+		m_wifi.disconnect();
+	}
+	beginAny();
+	return waitConnected(WIFI_CONNECT_MS);
+}
+
+auto ESaveWifi::rememberAP(const uint8_t *bssid, uint8_t channel, int8_t rssi, bool force) -> rtcMem::apCacheEntry * {
+	using rtcMem::gRTC;
+	rtcMem::apCacheEntry *slot = nullptr;
+	for (auto &ap : gRTC.ap_cache) {
+		if (ap.channel != 0 && memcmp(ap.bssid, bssid, sizeof(ap.bssid)) == 0) {
+			// Known AP, keep its history
+			ap.channel = channel;
+			ap.rssi    = rssi;
+			return &ap;
+		}
+		// First unused entry, otherwise the worst scored one
+		if (slot == nullptr || (slot->channel != 0 && (ap.channel == 0 || apScore(ap) < apScore(*slot)))) {
+			slot = &ap;
+		}
+	}
+	// Unless forced, only displace the worst entry if the new AP looks better
+	if (!force && slot->channel != 0 && apScore(*slot) >= rssi) {
+		return nullptr;
+	}
+	memcpy(slot->bssid, bssid, sizeof(slot->bssid));
+	slot->channel   = channel;
+	slot->rssi      = rssi;
+	slot->successes = 0;
+	slot->failures  = 0;
+	return slot;
+}
+
+void ESaveWifi::storeConnection() {
+	using rtcMem::gRTC;
+	uint32_t const ip = (uint32_t)m_wifi.localIP();
+	LOGI(LOG_MOD_WIFI, "WiFi Connected after %d ms", millis() - m_connectStart);
+	LOGI(LOG_MOD_WIFI, "Got IP: %d.%d.%d.%d", ip & 0xff, (ip >> 8) & 0xff, (ip >> 16) & 0xff, ip >> 24);
+
+	// The AP we ended up on always goes into the cache
+	auto *ap = rememberAP(m_wifi.BSSID(), m_wifi.channel(), m_wifi.RSSI(), true);
+	if (ap->successes < UINT8_MAX) {
+		ap->successes++;
+	}
+	ap->failures = 0;
+	m_isOn       = true;
+}
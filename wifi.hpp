@@ -2,15 +2,45 @@
 
 #include <ESP8266WiFi.h>
 
+#include "config.hpp"
+#include "rtc_mem.hpp"
+
+/*
+	Connects to SSID using the APs cached in RTC memory (gRTC.ap_cache):
+	 - cached APs are tried in ranked order (success history, RSSI), each given wifi_attempt_ms (runtime_config.hpp) to
+	   associate and then WIFI_DHCP_MS to get an address
+	 - only when all of them fail the SSID is scanned for, the cache updated from the scan results
+	   and the best AP found is tried, then any AP for SSID
+	 - all of it together takes at most WIFI_CONNECT_MS
+ */
 class ESaveWifi {
 public:
 	ESaveWifi();
 	auto turnOn() -> bool;
+	// Only powers up the radio on channel (0 => the best cached AP's), no association. For ESP-NOW, see espnow_link.hpp
+	auto turnOnRadio(uint8_t channel) -> bool;
 	auto checkStatus() -> bool;
 	void shutDown();
 	auto isOn() -> bool;
 
 private:
+	void rankCache();
+	void beginCached(uint8_t attempt);
+	void beginAny();
+	void startAttempt();
+	auto waitConnected(uint32_t assocMs) -> bool;
+	auto scanAndConnect() -> bool;
+	auto rememberAP(const uint8_t *bssid, uint8_t channel, int8_t rssi, bool force) -> rtcMem::apCacheEntry *;
+	void storeConnection();
+
 	ESP8266WiFiClass m_wifi;
 	bool             m_isOn;
-};
\ No newline at end of file
+	uint8_t          m_order[WIFI_AP_CACHE];   //!< cache indices, best first
+	uint8_t          m_candidates;             //!< number of valid entries in m_order
+	uint8_t          m_attempt;                //!< position in m_order currently tried
+	uint32_t         m_connectStart;           //!< millis() turnOn started connecting at
+	uint32_t         m_attemptStart;           //!< millis() the current attempt started at
+	uint32_t         m_associatedAt;           //!< millis() the current attempt associated at
+	volatile bool    m_associated;             //!< set from the WiFi event, DHCP may still be running
+	WiFiEventHandler m_onAssociated;
+};
@@ -6,26 +6,70 @@
 
 #include "bme280_aggregator.hpp"
 #include "debug.hpp"
+#include "espnow_link.hpp"
+#include "metrics_server.hpp"
+#include "msec_timespec.hpp"
+#include "ota_pull.hpp"
 #include "rtc_mem.hpp"
+#include "runtime_config.hpp"
+#include "sensor_tuner.hpp"
+#include "tls_session.hpp"
+#include "wake_budget.hpp"
 #include "wifi.hpp"
+#ifdef USE_SIM_SENSOR
+#include "bme280_sim.hpp"
+#endif
 
 // Parts of this project are based on https://bitbucket.org/2msd/d1mini_sht30_mqtt/src/master/d1mini_sht30_mqtt.ino
 
-BME280Aggregator bme;
+#if defined(USE_SIM_SENSOR)
+BME280Sim                                  simSensor;
+BME280Aggregator<BME280I2CBusT<BME280Sim>> bme;
+const BME280I2CBusT<BME280Sim>             bmeBus(0x76, &simSensor);
+#elif defined(USE_BME_SPI)
+BME280Aggregator<BME280SPIBus> bme;
+const BME280SPIBus             bmeBus(BME_SPI_CS);
+#else
+BME280Aggregator<BME280I2CBus> bme;
+const BME280I2CBus             bmeBus(0x76);
+#endif
 
 ESaveWifi eWifi;
 
-#define RECORD_LIMIT (STORED_RECORDS - 10)
+#ifdef USE_METRICS_SERVER
+#ifndef USE_OTA
+#error "USE_METRICS_SERVER requires the always connected USE_OTA build"
+#endif
+MetricsServer metrics;
+#endif
+
+#if defined(USE_ESPNOW) && defined(USE_OTA)
+#error "USE_ESPNOW is for USE_DEEPSLEEP nodes, OTA builds stay associated anyway"
+#endif
+#if defined(USE_ESPNOW_GATEWAY) && defined(USE_DEEPSLEEP)
+#error "The ESP-NOW gateway has to stay awake"
+#endif
+
+#ifdef USE_ESPNOW_GATEWAY
+WiFiClient gatewayClient;
+HTTPClient gatewayHttp;
+uint16_t   gatewaySeq = 0;
+#endif
 
-void execSleep(uint32_t sleepTime = INTERVAL_MS) {
+void execSleep(uint32_t sleepTime = runtimeConfig::current().interval_ms) {
 #ifdef USE_DEEPSLEEP
+	log_flush();
 	ESP.deepSleep(sleepTime * 1000);
 #else
 #ifdef USE_OTA
-	LOGF("OTAHandling: %d\n", sleepTime);
+	LOGI(LOG_MOD_MAIN, "OTAHandling: %d", sleepTime);
 	while (sleepTime > 0) {
+		log_flush();
 		uint32_t t1 = millis();
 		ArduinoOTA.handle();
+#ifdef USE_METRICS_SERVER
+		metrics.handle();
+#endif
 		uint32_t t2 = millis();
 		if (t2 - t1 < 50) {
 			delay(50);
@@ -37,8 +81,10 @@ void execSleep(uint32_t sleepTime = INTERVAL_MS) {
 			sleepTime = 0;
 		}
 	}
+	log_flush();
 #else
-	LOGF("Delaying: %d\n", sleepTime);
+	LOGI(LOG_MOD_MAIN, "Delaying: %d", sleepTime);
+	log_flush();
 	delay(sleepTime);
 #endif
 	ESP.reset();
@@ -50,21 +96,41 @@ void setup() {
 	using rtcMem::gRTC;
 	init_debug();
 
+#ifdef USE_ESPNOW_GATEWAY
+	gateway_setup();
+	return;
+#endif
+
 	LOGINTER("start");
 
 	if (!rtcMem::read()) {
-		LOGLN("Reading RTC data failed.");
+		LOGW(LOG_MOD_RTC, "Reading RTC data failed.");
 	}
 
 	// Check if we were woken up by default_rst => reset internal structs, data is out of date
-	LOGF("Resetreason: %d\n", ESP.getResetInfoPtr()->reason);
+	LOGI(LOG_MOD_MAIN, "Resetreason: %d", ESP.getResetInfoPtr()->reason);
 	if (ESP.getResetInfoPtr()->reason == REASON_EXT_SYS_RST) {
-		LOGLN("Ordinary Power ON, resetting stored records");
-		gRTC.stored_records = 0;
+		LOGI(LOG_MOD_MAIN, "Ordinary Power ON, resetting stored records");
+		rtcMem::clear_records();
 	}
 
+#ifdef USE_SIM_SENSOR
+	simSensor.setTimeSource([]() -> uint32_t { return micros(); });
+#endif
+
+#ifdef USE_SENSOR_TUNING
+	// Only on power on and the reset pin. Restarts (OTA, ESP.reset in OTA builds), watchdog and exception resets and
+	// wakes from deep sleep keep using the stored profile.
+	uint32_t const reason = ESP.getResetInfoPtr()->reason;
+	if (reason == REASON_DEFAULT_RST || reason == REASON_EXT_SYS_RST) {
+		sensorTuner::run(bme, bmeBus);
+		// Tuning takes minutes, the wake's budget only starts now
+		wakeBudget::startWake();
+	}
+#endif
+
 #ifdef USE_OTA
-	LOGLN("Starting wifi: OTA Enabled.");
+	LOGI(LOG_MOD_MAIN, "Starting wifi: OTA Enabled.");
 	eWifi.turnOn();
 	bool dump_stored = true;
 	ArduinoOTA.onStart([]() { Serial.println("Start"); });
@@ -84,35 +150,92 @@ void setup() {
 			Serial.println("End Failed");
 	});
 	ArduinoOTA.begin();
+#ifdef USE_METRICS_SERVER
+	metrics.begin();
+#endif
 #else
-	bool dump_stored = gRTC.stored_records > RECORD_LIMIT;
+	bool dump_stored = gRTC.stored_records > runtimeConfig::current().record_limit;
 
+#ifndef USE_ESPNOW
+	// Association runs in the background while the sensor is read
 	if (dump_stored) {
-		LOGLN("Starting wifi: Have enough stored.");
+		LOGI(LOG_MOD_MAIN, "Starting wifi: Have enough stored.");
 		eWifi.turnOn();
 	}
+#endif
 #endif
 
+	wakeBudget::begin(wakePhase::sensor);
 	auto retries = 0;
 	while (retries < 100) {
-		if (bme.begin(0x76)) {
+		auto const& cfg = runtimeConfig::current();
+		if (bme.begin(bmeBus, {cfg.osrs_t, cfg.osrs_p, cfg.osrs_h, cfg.filter})) {
 			break;
 		}
 		retries++;
 		delay(100);
+		wakeBudget::end();
+		rtcMem::write();
 		execSleep();
 		return;
 	}
 
 	auto full_data = bme.readAllSensors();
+#ifdef USE_SIM_SENSOR
+	LOGI(LOG_MOD_SENSOR,
+		 "Sensor bus: %u transactions, %u bytes out, %u bytes in, %u us on the wire",
+		 simSensor.stats().transactions,
+		 simSensor.stats().bytesWritten,
+		 simSensor.stats().bytesRead,
+		 simSensor.stats().busTimeUs);
+#endif
 
-	// Advance gRTC records
-	gRTC.records[gRTC.stored_records] = full_data;
-	gRTC.stored_records               = (gRTC.stored_records + 1) % STORED_RECORDS;
+	rtcMem::push_record(full_data);
+	wakeBudget::end();
 
-	if (dump_stored && eWifi.checkStatus()) {
+#ifdef USE_ESPNOW
+	// Only associate if the gateway doesn't take the records
+	if (dump_stored && send_records_via_espnow()) {
+		dump_stored = false;
+	} else if (dump_stored) {
+		LOGI(LOG_MOD_MAIN, "Starting wifi: Gateway didn't take the records.");
+		eWifi.turnOn();
+	}
+#endif
+
+	// Association was started before reading the sensor, only waiting for it counts against the budget
+	bool connected = false;
+	if (dump_stored) {
+		wakeBudget::begin(wakePhase::assoc);
+		connected = eWifi.checkStatus();
+		wakeBudget::end();
+	}
+
+	if (connected) {
 		LOGINTER("sending");
+#ifdef METRICS_PULL_ONLY
+		// Records stay in the store for the scraper, keep their timestamps in sync with the server.
+		// As the anchor is rebased each wake a new interval can't mess up the timestamps of stored records.
+		sync_anchor();
+		bool const can_apply_config = true;
+#else
+#ifdef USE_PULL_OTA
+		uint16_t const batches_before = gRTC.batch_seq;
+#endif
 		send_records_to_influx();
+		// Stored records are timestamped with the current interval, so only switch once they are gone
+		bool const can_apply_config = gRTC.stored_records == 0;
+#endif
+		if (gRTC.pending_cfg.version != 0 && can_apply_config) {
+			runtimeConfig::apply(gRTC.pending_cfg);
+			gRTC.pending_cfg = {};
+		}
+#if defined(USE_PULL_OTA) && !defined(METRICS_PULL_ONLY)
+		// Hashing the running build takes a while, only ask every OTA_CHECK_BATCHES batches
+		if (batches_before / OTA_CHECK_BATCHES != gRTC.batch_seq / OTA_CHECK_BATCHES) {
+			otaPull::update();
+		}
+#endif
 #ifndef USE_OTA
 		eWifi.shutDown();
 #endif
@@ -130,158 +253,409 @@ void setup() {
 	}
 	Serial.printf("Final time: %d\n", now);
 #endif
-	uint32_t sleepTime = 0;
-	if (now > INTERVAL_MS) {
-		LOGLN("Interval was too large. sleeping full length.");
-		sleepTime = INTERVAL_MS;
+	uint32_t const interval  = runtimeConfig::current().interval_ms;
+	uint32_t       sleepTime = 0;
+	if (now > interval) {
+		LOGW(LOG_MOD_MAIN, "Interval was too large. sleeping full length.");
+		sleepTime = interval;
 	} else {
-		sleepTime = (INTERVAL_MS - millis());
+		sleepTime = (interval - millis());
 	}
 	execSleep(sleepTime);
 }
 
 void loop() {
+#ifdef USE_ESPNOW_GATEWAY
+	gateway_loop();
+#else
 	LOGLN("I should not be here. I should be sleeping.");
 	delay(1000);
+#endif
 }
 
-/*
-	Slighly optimized variant of the usual timespec struct for our purposes:
-
-	Carry microseconds instead of ns + store thousand seconds instead of single
- */
-struct msec_timespec {
-	time_t tv_millionsec; /* MillionSeconds */
-	long   tv_millisec;   /* Milliseconds */
-
-	void subtract(uint32_t millisec) {
-		if (millisec > 1e9) {
-			LOGLN("Error: Can only subtract below 1M seconds");
-		}
-		if (millisec > tv_millisec) {
-			tv_millionsec--;
-			tv_millisec += 1e9;
-		}
-		tv_millisec -= millisec;
-	};
-
-	void add(uint32_t millisec) {
-		if (millisec > 1e9) {
-			LOGLN("Error: Can only subtract below 1M seconds");
-		}
-		tv_millisec += millisec;
-		if (tv_millisec > 1e9) {
-			tv_millionsec += 1;
-			tv_millisec -= 1e9;
-		}
-	}
-
-	String toString() {
-		char ts_string[24];
-		snprintf(ts_string, sizeof(ts_string), "%d%09d", tv_millionsec, tv_millisec);
-		return String(ts_string);
-	}
-};
-
-struct msec_timespec get_timestamp_from_server() {
+struct msec_timespec get_timestamp_from_server(String& config_line) {
 	struct msec_timespec res = {0, 0};
 	WiFiClient           client;
 	HTTPClient           http;
-	if (http.begin(client, TS_URL)) {
+	// Tell the server which config we run, it only sends one back if it has a different version
+	String url = TS_URL;
+	url += "?id=";
+	url += ESP.getChipId();
+	url += "&cfg=";
+	url += runtimeConfig::current().version;
+	if (http.begin(client, url)) {
+		// The client's timeout bounds DNS and connect, HTTPClient's only the response
+		client.setTimeout(wakeBudget::timeout());
+		http.setTimeout(wakeBudget::timeout());
 		int httpCode = http.GET();
 		if (httpCode > 0) {
-			LOGF("[HTTP] GET TS... code: %d\n", httpCode);
+			LOGD(LOG_MOD_NET, "[HTTP] GET TS... code: %d", httpCode);
 
 			if (httpCode == HTTP_CODE_OK) {
-				LOGLN("Received timestamp successfully.");
+				LOGD(LOG_MOD_NET, "Received timestamp successfully.");
 				String data = http.getString();
 				data.trim();
+				int line_end = data.indexOf('\n');
+				if (line_end >= 0) {
+					config_line = data.substring(line_end + 1);
+					data        = data.substring(0, line_end);
+					data.trim();
+				}
 				if (data.length() != 13) {
-					LOGLN("Invalid length of time page. Wrong server?");
+					LOGE(LOG_MOD_NET, "Invalid length of time page (%d bytes). Wrong server?", data.length());
 					return res;
 				}
-				LOG("TS string: ");
-				LOGLN(data);
 				LOGINTER("Converting");
 				String micsString = data.substring(data.length() - 9);
 				String ksString   = data.substring(0, data.length() - 9);
-				LOGLN(ksString);
-				LOGLN(micsString);
-				res = {ksString.toInt(), micsString.toInt()};
+				res = {static_cast<int32_t>(ksString.toInt()), static_cast<int32_t>(micsString.toInt())};
+				LOGD(LOG_MOD_NET, "TS: %d %09d", res.tv_millionsec, res.tv_millisec);
 			}
 		} else {
-			LOGF("[HTTP] GET TS... failed, error: %s\n", http.errorToString(httpCode).c_str());
+			LOGE(LOG_MOD_NET, "[HTTP] GET TS... failed, error: %d", httpCode);
 		}
 		http.end();
 	}
 	return res;
 }
 
-bool send_single_data_to_influx(String& data) {
-	LOGLN(data);
-	WiFiClient client;
-	HTTPClient http;
+// Returns the HTTP status code, negative if the request failed before that
+int send_single_data_to_influx(HTTPClient& http, String& data, uint16_t batch_seq) {
+	LOGD(LOG_MOD_NET, "Sending batch %u, %d bytes", batch_seq, data.length());
+	// Influx ignores this, retries of a batch carry the same number (and timestamps) so a proxy can dedupe
+	http.addHeader("X-Batch-Seq", String(batch_seq));
+	int httpCode = http.POST(data);
+	if (httpCode > 0) {
+		LOGD(LOG_MOD_NET, "[HTTP] POST... code: %d", httpCode);
+
+		if (httpCode == HTTP_CODE_OK || httpCode == HTTP_CODE_NO_CONTENT) {
+			LOGI(LOG_MOD_NET, "Uploaded batch %u successfully.", batch_seq);
+		}
+	} else {
+		// Negative codes are HTTPC_ERROR_*, see ESP8266HTTPClient.h
+		LOGE(LOG_MOD_NET, "[HTTP] POST... failed, error: %d", httpCode);
+	}
 
-	bool res = false;
+	// Keeps the connection open for the next chunk (setReuse)
+	http.end();
+	return httpCode;
+}
 
-	LOGLN("Sending data...");
-	if (http.begin(client, DB_URL)) {
-		int httpCode = http.POST(data);
-		if (httpCode > 0) {
-			LOGF("[HTTP] POST... code: %d\n", httpCode);
+bool sync_anchor() {
+	using rtcMem::gRTC;
+
+	LOGINTER("Start TS");
+	wakeBudget::begin(wakePhase::timesync);
+	String config_line;
+	auto   ts = get_timestamp_from_server(config_line);
+	if (ts.tv_millionsec == 0) {
+		if (wakeBudget::expired()) {
+			wakeBudget::end();
+			return false;
+		}
+		LOGW(LOG_MOD_NET, "Failed, retrying...");
+		ts = get_timestamp_from_server(config_line);
+		if (ts.tv_millionsec == 0) {
+			LOGE(LOG_MOD_NET, "Final fail.");
+			wakeBudget::end();
+			return false;
+		}
+	}
+	wakeBudget::end();
+	LOGINTER("End TS");
+	if (config_line.length()) {
+		// Kept in RTC memory until the records stored with the current interval are uploaded, which can take wakes
+		runtime_config received;
+		if (runtimeConfig::parse(config_line, received)) {
+			LOGI(LOG_MOD_CFG, "Config version %d from server", received.version);
+			gRTC.pending_cfg = received;
+		}
+	}
+	// Newest record was just taken, the older ones are one interval apart.
+	// The anchor is persisted, so retried records keep their timestamp and influx overwrites instead of duplicating.
+	ts.subtract((gRTC.stored_records - 1) * runtimeConfig::current().interval_ms);
+	gRTC.anchor = ts;
+	return true;
+}
+
+void send_records_to_influx() {
+	using rtcMem::gRTC;
+
+	if (!gRTC.anchor.is_set() && !sync_anchor()) {
+		return;
+	}
+
+	wakeBudget::begin(wakePhase::upload);
+#ifdef USE_TLS
+	BearSSL::WiFiClientSecure client;
+	tlsSession::prepare(client);
+#else
+	WiFiClient client;
+#endif
+	HTTPClient http;
+	// All chunks of a wake go over the same connection, with TLS that's a single handshake
+	http.setReuse(true);
+	if (!http.begin(client, DB_URL)) {
+		wakeBudget::end();
+		return;
+	}
+	bool    first_request = true;
+	uint8_t reported_blown[sizeof(gRTC.budget_blown)];
+#ifdef USE_PULL_OTA
+	otaResult const reported_ota = gRTC.ota_result;
+#endif
 
-			if (httpCode == HTTP_CODE_OK || httpCode == HTTP_CODE_NO_CONTENT) {
-				LOGLN("Uploaded data successfully.");
-				res = true;
+	// Upload from the committed cursor on, each chunk is only released once the server acknowledged it
+	while (gRTC.stored_records > 0 && !wakeBudget::expired()) {
+		String  influx_data = "";
+		uint8_t count       = 0;
+		auto    ts          = gRTC.anchor;
+		influx_data.reserve(runtimeConfig::current().chunk_bytes + 80);
+		if (first_request) {
+			// Counted up to now, the upload phase of this wake can still add to them while the request runs
+			memcpy(reported_blown, gRTC.budget_blown, sizeof(reported_blown));
+			append_budget_report(influx_data, reported_blown, ts);
+#ifdef USE_PULL_OTA
+			append_ota_report(influx_data, reported_ota, ts);
+#endif
+#ifdef USE_TLS
+			append_tls_report(influx_data, ts);
+#endif
+		}
+		while (count < gRTC.stored_records && influx_data.length() < runtimeConfig::current().chunk_bytes) {
+			auto record = rtcMem::record_at(count);
+			// Records lost to a corrupted RTC block are skipped, but still take up their interval
+			if (record != nullptr) {
+				influx_data += "bme280,host=";
+				influx_data += ESP.getChipId();
+				influx_data += " ";
+				influx_data += record->toString();
+				influx_data += " ";
+				influx_data += ts.toString();
+				influx_data += "000000\n";
 			}
-		} else {
-			LOGF("[HTTP] POST... failed, error: %s\n", http.errorToString(httpCode).c_str());
+			ts.add(runtimeConfig::current().interval_ms);
+			count++;
 		}
+		if (influx_data.length()) {
+			auto const start = millis();
+			// Connects again if the server closed the connection, DNS and connect are bounded by the client's timeout
+			client.setTimeout(wakeBudget::timeout());
+			http.setTimeout(wakeBudget::timeout());
+			int const httpCode = send_single_data_to_influx(http, influx_data, gRTC.batch_seq);
+			// Any response means the handshake went through
+			if (first_request && httpCode > 0) {
+#ifdef USE_TLS
+				tlsSession::report(millis() - start);
+#else
+				LOGI(LOG_MOD_NET, "First request took %d ms", millis() - start);
+#endif
+			}
+			if (httpCode != HTTP_CODE_OK && httpCode != HTTP_CODE_NO_CONTENT) {
+				LOGW(LOG_MOD_NET, "Batch %d failed, keeping %d records for next wake", gRTC.batch_seq, gRTC.stored_records);
+				break;
+			}
+			if (first_request) {
+				for (uint8_t i = 0; i < sizeof(reported_blown); i++) {
+					gRTC.budget_blown[i] -= reported_blown[i];
+				}
+#ifdef USE_PULL_OTA
+				gRTC.ota_result = otaResult::none;
+#endif
+#ifdef USE_TLS
+				gRTC.tls_request_ms = 0;
+#endif
+			}
+			first_request = false;
+		}
+		rtcMem::release_records(count);
+	}
+#ifdef USE_TLS
+	// Also after a failed batch, the handshake itself may well have succeeded
+	tlsSession::save();
+#endif
+	client.stop();
+	wakeBudget::end();
+}
 
-		http.end();
+// Appends a line with the phases that ran out of time since the last report, if there were any.
+// Timestamped like the chunk it goes with, so a resent chunk overwrites it instead of counting twice.
+void append_budget_report(String& influx_data, const uint8_t* blown, const msec_timespec& ts) {
+	bool any = false;
+	for (uint8_t i = 0; i < static_cast<uint8_t>(wakePhase::count); i++) {
+		any |= blown[i] != 0;
 	}
-	return res;
+	if (!any) {
+		return;
+	}
+	influx_data += "wake_budget,host=";
+	influx_data += ESP.getChipId();
+	for (uint8_t i = 0; i < static_cast<uint8_t>(wakePhase::count); i++) {
+		influx_data += i == 0 ? " " : ",";
+		influx_data += wakeBudget::name(static_cast<wakePhase>(i));
+		influx_data += "=";
+		influx_data += blown[i];
+		influx_data += "i";
+	}
+	influx_data += " ";
+	influx_data += ts.toString();
+	influx_data += "000000\n";
 }
 
-void send_records_to_influx() {
+#ifdef USE_PULL_OTA
+// Result of the last update attempt, timestamped like the chunk so a resent chunk doesn't report it twice
+void append_ota_report(String& influx_data, otaResult result, const msec_timespec& ts) {
+	if (result == otaResult::none) {
+		return;
+	}
+	influx_data += "ota,host=";
+	influx_data += ESP.getChipId();
+	influx_data += " result=\"";
+	influx_data += otaPull::name(result);
+	// After an install that's the new build, so the server can tell it came up
+	influx_data += "\",build=\"";
+	influx_data += ESP.getSketchMD5();
+	influx_data += "\" ";
+	influx_data += ts.toString();
+	influx_data += "000000\n";
+}
+#endif
+
+#ifdef USE_TLS
+// Handshake of the last upload wake, with the timestamp of the chunk so a resent chunk overwrites it
+void append_tls_report(String& influx_data, const msec_timespec& ts) {
+	if (rtcMem::gRTC.tls_request_ms == 0) {
+		return;
+	}
+	influx_data += "tls,host=";
+	influx_data += ESP.getChipId();
+	influx_data += rtcMem::gRTC.tls_resumed ? " resumed=true" : " resumed=false";
+	influx_data += ",first_request_ms=";
+	influx_data += rtcMem::gRTC.tls_request_ms;
+	influx_data += "i ";
+	influx_data += ts.toString();
+	influx_data += "000000\n";
+}
+#endif
+
+#ifdef USE_ESPNOW
+// Sends the stored records to the gateway, true if it acked all of them
+bool send_records_via_espnow() {
 	using rtcMem::gRTC;
 
-	LOGINTER("Start TS");
-	auto ts = get_timestamp_from_server();
-	if (ts.tv_millionsec == 0) {
-		LOGLN("Failed, retrying...");
-		ts = get_timestamp_from_server();
-		if (ts.tv_millionsec == 0) {
-			LOGLN("Final fail.");
+	wakeBudget::begin(wakePhase::upload);
+	if (!eWifi.turnOnRadio(ESPNOW_CHANNEL)) {
+		// Radio is still off, nothing to shut down before the WiFi fallback turns it on
+		wakeBudget::end();
+		return false;
+	}
+	bool acked = espNowLink::begin();
+	// Like send_records_to_influx each batch starts at the committed cursor and is released once acked
+	while (acked && gRTC.stored_records > 0) {
+		espnowBatch   batch  = {};
+		uint8_t const count  = std::min<uint8_t>(gRTC.stored_records, ESPNOW_BATCH_RECORDS);
+		auto&         header = batch.header;
+		header.type          = ESPNOW_TYPE_BATCH;
+		header.count         = count;
+		header.newest_offset = gRTC.stored_records - 1;
+		header.batch_seq     = gRTC.batch_seq;
+		header.boot_id       = gRTC.boot_id;
+		header.chip_id       = ESP.getChipId();
+		header.interval_ms   = runtimeConfig::current().interval_ms;
+		header.anchor        = gRTC.anchor;
+		header.first_seq     = gRTC.record_seq - gRTC.stored_records + 1;
+		for (uint8_t i = 0; i < count; i++) {
+			auto record = rtcMem::record_at(i);
+			if (record != nullptr) {
+				batch.records[i] = *record;
+				header.valid |= 1UL << i;
+			}
+		}
+		msec_timespec anchor;
+		acked = espNowLink::send(batch, count, anchor);
+		if (acked) {
+			gRTC.anchor = anchor;
+			rtcMem::release_records(count);
+		}
+	}
+	espNowLink::end();
+	eWifi.shutDown();
+	wakeBudget::end();
+	return acked;
+}
+#endif
+
+#ifdef USE_ESPNOW_GATEWAY
+void gateway_setup() {
+	LOGI(LOG_MOD_MAIN, "Starting ESP-NOW gateway");
+	eWifi.turnOn();
+	while (!eWifi.checkStatus()) {
+		log_flush();
+		delay(1000);
+		eWifi.turnOn();
+	}
+	// Modem sleep would miss ESP-NOW frames between beacons
+	WiFi.setSleepMode(WIFI_NONE_SLEEP);
+	// Kept open, the gateway forwards to influx all the time
+	gatewayHttp.setReuse(true);
+	gatewayHttp.begin(gatewayClient, DB_URL);
+	if (!espNowGateway::begin()) {
+		LOGE(LOG_MOD_NET, "ESP-NOW gateway setup failed");
+	}
+	log_flush();
+}
+
+void gateway_loop() {
+	// Nodes' records are timestamped by the gateway's clock, keep it in sync with the timeserver
+	uint32_t const synced = espNowGateway::timeSetAt();
+	if (synced == 0 || millis() - synced > GATEWAY_RESYNC_MS) {
+		String config_line;
+		auto   ts = get_timestamp_from_server(config_line);
+		if (ts.is_set()) {
+			espNowGateway::setTime(ts);
+		} else if (synced == 0) {
+			log_flush();
+			delay(1000);
 			return;
 		}
 	}
-	LOGINTER("End TS");
 
-	String influx_data = "";
-	influx_data.reserve(80 * gRTC.stored_records);
-	for (int16_t i = gRTC.stored_records - 1; i >= 0; i--) {
-		influx_data += "bme280,host=";
-		influx_data += ESP.getChipId();
-		influx_data += " ";
-		influx_data += gRTC.records[i].toString();
-
-		// LOG("Reassembled ts: ");
-		// LOGLN(String(ts_string));
-
-		influx_data += " ";
-		influx_data += ts.toString();
-		influx_data += "000000\n";
-		ts.subtract(INTERVAL_MS);
-		if (influx_data.length() >= 512) {
-			send_single_data_to_influx(influx_data);
-			influx_data = "";
+	// Nodes wait for their ack, so forward right away. Only acked once influx took them, until then the nodes keep them.
+	String             body;
+	uint8_t            count = 0;
+	const espnowBatch* batch;
+	while (body.length() < runtimeConfig::current().chunk_bytes && (batch = espNowGateway::peek(count)) != nullptr) {
+		auto ts = batch->header.anchor;
+		for (uint8_t i = 0; i < batch->header.count; i++) {
+			if (batch->header.valid & (1UL << i)) {
+				body += "bme280,host=";
+				body += batch->header.chip_id;
+				body += " ";
+				body += batch->records[i].toString();
+				body += " ";
+				body += ts.toString();
+				body += "000000\n";
+			}
+			ts.add(batch->header.interval_ms);
+		}
+		count++;
+	}
+	if (count > 0) {
+		// Resent batches whose records were all forwarded before only need their ack
+		int const httpCode = body.length() > 0 ? send_single_data_to_influx(gatewayHttp, body, gatewaySeq) : HTTP_CODE_NO_CONTENT;
+		if (httpCode == HTTP_CODE_OK || httpCode == HTTP_CODE_NO_CONTENT) {
+			espNowGateway::ack(count);
+			gatewaySeq++;
+		} else {
+			// The queue fills up meanwhile and nodes stop getting acks, so they upload themselves
+			LOGW(LOG_MOD_NET, "Influx unreachable, holding %d batches", count);
+			delay(1000);
 		}
 	}
-	if (influx_data.length()) {
-		send_single_data_to_influx(influx_data);
+	uint32_t const dropped = espNowGateway::sendAcks();
+	if (dropped > 0) {
+		LOGW(LOG_MOD_NET, "Gateway queue full, %u batches not taken", dropped);
 	}
-
-	// Reset our store
-	gRTC.stored_records = 0;
+	log_flush();
 }
+#endif